@@ -0,0 +1,480 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Decentralized work-stealing of migratable components between localities.
+//
+// Every locality owns a work_queue holding the ids of the A/B components it
+// still has to process. There is no central planner: whenever the local
+// queue drops to the low water mark the worker asks a peer for more work.
+// A peer which holds more than its high water mark hands over a batch of its
+// components by migrating them to the thief, the thief then processes them
+// locally. The thresholds can be set on the command line, e.g.
+//
+//     --hpx:ini=mwe.steal.low_water_mark=2
+//     --hpx:ini=mwe.steal.high_water_mark=4
+//     --hpx:ini=mwe.steal.batch_size=8
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+struct A
+  : hpx::components::migration_support<
+        hpx::components::component_base<A>
+    >
+{
+    typedef hpx::components::migration_support<
+            hpx::components::component_base<A>
+        > base_type;
+
+    A()=default;
+    explicit A(int data) : dataA_(data) {}
+    virtual ~A() {}
+
+    hpx::id_type call() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return hpx::find_here();
+    }
+
+    virtual int get_data() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return dataA_;
+    }
+
+    int get_data_nonvirt() const { return get_data(); }
+
+    A(A const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_)
+    {}
+
+    A(A && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_)
+    {}
+
+    A& operator=(A const & rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+    A& operator=(A && rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(A, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data_nonvirt, get_data_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        ar & dataA_;
+    }
+    HPX_SERIALIZATION_POLYMORPHIC(A);
+
+protected:
+    int dataA_ = 0;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::call_action call_action;
+HPX_REGISTER_ACTION_DECLARATION(call_action);
+HPX_REGISTER_ACTION(call_action);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+struct B : A, hpx::components::component_base<B>
+{
+    using wrapping_type = hpx::components::component_base<B>::wrapping_type;
+    using wrapped_type  = hpx::components::component_base<B>::wrapped_type;
+
+    using type_holder = B;
+    using base_type_holder = A;
+
+    B()=default;
+    explicit B(int data) : dataB_(data) {}
+    virtual ~B() {}
+
+    int get_data() const override
+    {
+        HPX_TEST(pin_count() != 0);
+        return dataB_;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & hpx::serialization::base_object<A>(*this);
+        ar & dataB_;
+    }
+    HPX_SERIALIZATION_POLYMORPHIC(B);
+protected:
+    int dataB_=0;
+};
+
+typedef hpx::components::simple_component<B> serverB_type;
+HPX_REGISTER_DERIVED_COMPONENT_FACTORY(serverB_type, B, "A");
+
+struct clientA
+  : hpx::components::client_base<clientA, A>
+{
+    typedef hpx::components::client_base<clientA, A>
+        base_type;
+
+    clientA() {}
+    clientA(hpx::shared_future<hpx::id_type> const& id) : base_type(id) {}
+    clientA(hpx::id_type && id) : base_type(std::move(id)) {}
+
+    hpx::id_type call() const
+    {
+        return call_action()(this->get_id());
+    }
+
+    int get_data() const
+    {
+        return get_data_action()(this->get_id());
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Thresholds controlling when a locality steals and how much a victim gives
+struct steal_policy
+{
+    steal_policy()
+      : low_water_mark(2), high_water_mark(4), batch_size(8)
+    {}
+
+    // a worker asks a peer for more work once its own queue holds no more
+    // than this many components
+    std::size_t low_water_mark;
+
+    // a victim only hands over work while it holds more than this many
+    // components
+    std::size_t high_water_mark;
+
+    // the maximum number of components migrated per steal request
+    std::size_t batch_size;
+
+    static steal_policy from_config()
+    {
+        steal_policy p;
+        p.low_water_mark = std::stoul(hpx::get_config_entry(
+            "mwe.steal.low_water_mark", std::to_string(p.low_water_mark)));
+        p.high_water_mark = std::stoul(hpx::get_config_entry(
+            "mwe.steal.high_water_mark", std::to_string(p.high_water_mark)));
+        p.batch_size = std::stoul(hpx::get_config_entry(
+            "mwe.steal.batch_size", std::to_string(p.batch_size)));
+        p.validate();
+        return p;
+    }
+
+    void validate() const
+    {
+        // otherwise two peers can keep stealing the same components from
+        // each other
+        if (low_water_mark >= high_water_mark)
+        {
+            HPX_THROW_EXCEPTION(hpx::bad_parameter, "steal_policy::validate",
+                "the low water mark has to be below the high water mark");
+        }
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & low_water_mark & high_water_mark & batch_size;
+    }
+};
+
+struct worker_stats
+{
+    worker_stats()
+      : processed(0), stolen(0), sum(0)
+    {}
+
+    std::size_t processed;      // components processed by this locality
+    std::size_t stolen;         // components migrated here from peers
+    std::int64_t sum;           // sum of the data of all processed components
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & processed & stolen & sum;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct work_queue
+  : hpx::components::component_base<work_queue>
+{
+    typedef hpx::lcos::local::spinlock mutex_type;
+
+    work_queue() = default;
+    explicit work_queue(steal_policy const& policy)
+      : policy_(policy)
+    {}
+
+    void push(std::vector<hpx::id_type> const& items)
+    {
+        std::lock_guard<mutex_type> l(mtx_);
+        items_.insert(items_.end(), items.begin(), items.end());
+    }
+
+    // Called by an idle peer, migrates up to batch_size components to the
+    // thief and returns their ids. Returns nothing if this locality is not
+    // loaded enough to give away work.
+    std::vector<hpx::id_type> steal(hpx::id_type const& thief)
+    {
+        std::vector<hpx::id_type> loot;
+        {
+            std::lock_guard<mutex_type> l(mtx_);
+            while (items_.size() > policy_.high_water_mark &&
+                loot.size() != policy_.batch_size)
+            {
+                // hand out the components we would process last
+                loot.push_back(std::move(items_.back()));
+                items_.pop_back();
+            }
+        }
+
+        std::vector<hpx::future<hpx::id_type> > migrated;
+        migrated.reserve(loot.size());
+        for (hpx::id_type const& id : loot)
+            migrated.push_back(hpx::components::migrate<A>(id, thief));
+
+        hpx::wait_all(migrated);
+
+        std::vector<hpx::id_type> result;
+        result.reserve(loot.size());
+        for (std::size_t i = 0; i != loot.size(); ++i)
+        {
+            if (migrated[i].has_exception())
+            {
+                // the component stays here, process it ourselves
+                push(std::vector<hpx::id_type>(1, loot[i]));
+                continue;
+            }
+            result.push_back(migrated[i].get());
+        }
+        return result;
+    }
+
+    // Process the local queue until it runs dry and no peer is willing to
+    // hand over more work.
+    worker_stats run(std::vector<hpx::id_type> const& peers)
+    {
+        worker_stats stats;
+
+        // start with a different victim on every locality
+        std::size_t next_peer =
+            peers.empty() ? 0 : hpx::get_locality_id() % peers.size();
+        std::size_t failed_steals = 0;
+
+        while (true)
+        {
+            hpx::id_type item;
+            std::size_t remaining = 0;
+            bool have_item = pop(item, remaining);
+
+            if (have_item)
+                process(item, stats);
+
+            // every peer refused in a row, nobody has work to spare
+            bool peers_exhausted = failed_steals >= peers.size();
+
+            if (!have_item && peers_exhausted)
+                break;
+
+            if (remaining <= policy_.low_water_mark && !peers_exhausted)
+            {
+                std::vector<hpx::id_type> loot = steal_action()(
+                    peers[next_peer], hpx::find_here());
+                next_peer = (next_peer + 1) % peers.size();
+
+                if (loot.empty())
+                {
+                    ++failed_steals;
+                }
+                else
+                {
+                    failed_steals = 0;
+                    stats.stolen += loot.size();
+                    push(loot);
+                }
+            }
+        }
+
+        return stats;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(work_queue, push, push_action);
+    HPX_DEFINE_COMPONENT_ACTION(work_queue, steal, steal_action);
+    HPX_DEFINE_COMPONENT_ACTION(work_queue, run, run_action);
+
+private:
+    bool pop(hpx::id_type& item, std::size_t& remaining)
+    {
+        std::lock_guard<mutex_type> l(mtx_);
+        if (items_.empty())
+        {
+            remaining = 0;
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        remaining = items_.size();
+        return true;
+    }
+
+    static void process(hpx::id_type const& item, worker_stats& stats)
+    {
+        // stolen components must have been migrated here before being
+        // processed
+        HPX_TEST_EQ(call_action()(item), hpx::find_here());
+
+        stats.sum += get_data_action()(item);
+        ++stats.processed;
+
+        // pretend this takes a while, this is what makes stealing pay off
+        hpx::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    mutable mutex_type mtx_;
+    std::deque<hpx::id_type> items_;
+    steal_policy policy_;
+};
+
+typedef hpx::components::simple_component<work_queue> work_queue_type;
+HPX_REGISTER_COMPONENT(work_queue_type, work_queue);
+
+typedef work_queue::push_action push_action;
+HPX_REGISTER_ACTION_DECLARATION(push_action);
+HPX_REGISTER_ACTION(push_action);
+
+typedef work_queue::steal_action steal_action;
+HPX_REGISTER_ACTION_DECLARATION(steal_action);
+HPX_REGISTER_ACTION(steal_action);
+
+typedef work_queue::run_action run_action;
+HPX_REGISTER_ACTION_DECLARATION(run_action);
+HPX_REGISTER_ACTION(run_action);
+
+///////////////////////////////////////////////////////////////////////////////
+bool test_skewed_work_stealing(std::size_t num_items)
+{
+    std::vector<hpx::id_type> localities = hpx::find_all_localities();
+    steal_policy policy = steal_policy::from_config();
+
+    // one queue per locality
+    std::vector<hpx::id_type> queues;
+    for (hpx::id_type const& loc : localities)
+        queues.push_back(hpx::new_<work_queue>(loc, policy).get());
+
+    // deliberately skewed: all of the work starts out on this locality
+    std::vector<hpx::id_type> items;
+    std::int64_t expected_sum = 0;
+    for (std::size_t i = 0; i != num_items; ++i)
+    {
+        clientA item = (i % 2 == 0) ?
+            hpx::new_<clientA>(hpx::find_here(), int(i)) :
+            clientA(hpx::components::new_<B>(hpx::find_here(), int(i)));
+        HPX_TEST_EQ(item.call(), hpx::find_here());
+
+        items.push_back(item.get_id());
+        expected_sum += int(i);
+    }
+    push_action()(queues[0], items);
+
+    try {
+        // start all workers, each knows about all the other queues
+        std::vector<hpx::future<worker_stats> > workers;
+        for (std::size_t i = 0; i != queues.size(); ++i)
+        {
+            std::vector<hpx::id_type> peers;
+            for (std::size_t j = 0; j != queues.size(); ++j)
+            {
+                if (j != i)
+                    peers.push_back(queues[j]);
+            }
+            workers.push_back(hpx::async<run_action>(queues[i], peers));
+        }
+
+        std::size_t processed = 0;
+        std::size_t stolen = 0;
+        std::int64_t sum = 0;
+        for (std::size_t i = 0; i != workers.size(); ++i)
+        {
+            worker_stats stats = workers[i].get();
+
+            hpx::cout << "locality " << i << ": processed " << stats.processed
+                << ", stolen " << stats.stolen << std::endl;
+
+            processed += stats.processed;
+            stolen += stats.stolen;
+            sum += stats.sum;
+        }
+
+        // every component was processed exactly once
+        HPX_TEST_EQ(processed, num_items);
+        HPX_TEST_EQ(sum, expected_sum);
+
+        // idle localities should have pulled some of the work
+        if (localities.size() > 1)
+            HPX_TEST_NEQ(stolen, std::size_t(0));
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool test_invalid_steal_policy()
+{
+    steal_policy policy;
+    policy.low_water_mark = policy.high_water_mark;
+
+    bool caught_exception = false;
+    try {
+        policy.validate();
+    }
+    catch (hpx::exception const& e) {
+        caught_exception = e.get_error() == hpx::bad_parameter;
+    }
+    HPX_TEST(caught_exception);
+
+    return caught_exception;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    hpx::cout << "test_invalid_steal_policy" << std::endl;
+    HPX_TEST(test_invalid_steal_policy());
+
+    hpx::cout << "test_skewed_work_stealing" << std::endl;
+    HPX_TEST(test_skewed_work_stealing(64));
+
+    return hpx::util::report_errors();
+}
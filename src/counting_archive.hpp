@@ -0,0 +1,57 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Measuring the serialized size of an object without storing the data.
+
+#if !defined(MWE_COUNTING_ARCHIVE_HPP)
+#define MWE_COUNTING_ARCHIVE_HPP
+
+#include <hpx/include/serialization.hpp>
+#include <hpx/traits/serialization_access_data.hpp>
+
+#include <cstddef>
+
+///////////////////////////////////////////////////////////////////////////////
+// Output container which only keeps track of how many bytes were written
+struct byte_counter
+{
+    std::size_t size_ = 0;
+};
+
+namespace hpx { namespace traits
+{
+    template <>
+    struct serialization_access_data<byte_counter>
+      : default_serialization_access_data<byte_counter>
+    {
+        static std::size_t size(byte_counter const& cont)
+        {
+            return cont.size_;
+        }
+
+        // count is the number of bytes appended, not the new size
+        static void resize(byte_counter& cont, std::size_t count)
+        {
+            cont.size_ += count;
+        }
+
+        static void write(byte_counter&, std::size_t, std::size_t,
+            void const*)
+        {
+        }
+    };
+}}
+
+// Return the number of bytes serializing t would produce
+template <typename T>
+std::size_t count_serialized_size(T const& t)
+{
+    byte_counter counter;
+    {
+        hpx::serialization::output_archive ar(counter);
+        ar << t;
+    }
+    return counter.size_;
+}
+
+#endif
@@ -0,0 +1,336 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Devirtualized action dispatch for derived components.
+//
+// HPX_DEFINE_COMPONENT_ACTION can only bind to the base class of a
+// polymorphic component, so the usual pattern is an action on a
+// non-virtual shim in the base (get_data_nonvirt) which calls a virtual
+// function. Every call pays for the shim and a virtual call through the A*,
+// and it is easy to get the override wrong: a non-const B::get_data()
+// silently does not override A::get_data() const.
+//
+// MWE_DEFINE_DEVIRTUALIZED_ACTION defines one action per concrete component
+// type, which calls the member of that type directly (without virtual
+// dispatch) and fails to compile unless the member is declared in that type
+// with exactly the signature of the base member. The client resolves the
+// concrete component type of its object once and from then on invokes the
+// matching action.
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/runtime/agas/interface.hpp>
+#include <hpx/util/high_resolution_timer.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename F>
+struct member_function_traits;
+
+template <typename R, typename C>
+struct member_function_traits<R (C::*)()>
+{
+    typedef R result_type;
+    typedef C class_type;
+    static bool const is_const = false;
+};
+
+template <typename R, typename C>
+struct member_function_traits<R (C::*)() const>
+{
+    typedef R result_type;
+    typedef C class_type;
+    static bool const is_const = true;
+};
+
+// Define an action named 'name' in 'derived' which calls derived::func
+// without going through the virtual function table. 'func' has to be
+// declared in 'derived' with the same result type and constness as in
+// 'base', otherwise it would not override base::func. Only nullary const
+// member functions are supported.
+#define MWE_DEFINE_DEVIRTUALIZED_ACTION(base, derived, func, name)            \
+    member_function_traits<decltype(&base::func)>::result_type                \
+    func##_direct() const                                                     \
+    {                                                                         \
+        typedef member_function_traits<decltype(&base::func)> base_traits;    \
+        typedef member_function_traits<decltype(&derived::func)>              \
+            derived_traits;                                                   \
+        static_assert(std::is_same<                                           \
+                derived_traits::class_type, derived>::value,                  \
+            #derived "::" #func " is not declared in " #derived);             \
+        static_assert(std::is_same<derived_traits::result_type,               \
+                base_traits::result_type>::value &&                           \
+            derived_traits::is_const == base_traits::is_const,                \
+            #derived "::" #func " does not override " #base "::" #func);      \
+        return this->derived::func();                                         \
+    }                                                                         \
+    HPX_DEFINE_COMPONENT_ACTION(derived, func##_direct, name)                 \
+    /**/
+
+///////////////////////////////////////////////////////////////////////////////
+// Maps concrete component types to the devirtualized action to invoke for
+// them
+template <typename Result>
+struct dispatch_table
+{
+    typedef hpx::future<Result> (*invoke_type)(hpx::id_type const&);
+
+    template <typename Component, typename Action>
+    void add()
+    {
+        table_[hpx::components::get_component_type<Component>()] =
+            &dispatch_table::invoke<Action>;
+    }
+
+    // return the action for the given type, or the fallback if the type
+    // has not been registered
+    invoke_type find(hpx::components::component_type type,
+        invoke_type fallback) const
+    {
+        auto it = table_.find(type);
+        return it == table_.end() ? fallback : it->second;
+    }
+
+private:
+    template <typename Action>
+    static hpx::future<Result> invoke(hpx::id_type const& id)
+    {
+        return hpx::async<Action>(id);
+    }
+
+    std::map<hpx::components::component_type, invoke_type> table_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+struct A : hpx::components::component_base<A>
+{
+    A()=default;
+    explicit A(int data) : dataA_(data) {}
+    virtual ~A() {}
+
+    virtual int get_data() const { return dataA_; }
+
+    // the virtual path
+    int get_data_nonvirt() const { return get_data(); }
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data_nonvirt, get_data_action);
+
+    // the devirtualized path
+    MWE_DEFINE_DEVIRTUALIZED_ACTION(A, A, get_data, get_data_direct_action);
+
+protected:
+    int dataA_ = 0;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+typedef A::get_data_direct_action get_data_direct_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_direct_action);
+HPX_REGISTER_ACTION(get_data_direct_action);
+
+struct B : A, hpx::components::component_base<B>
+{
+    using wrapping_type = hpx::components::component_base<B>::wrapping_type;
+    using wrapped_type  = hpx::components::component_base<B>::wrapped_type;
+
+    using type_holder = B;
+    using base_type_holder = A;
+
+    B()=default;
+    explicit B(int data) : dataB_(data) {}
+    virtual ~B() {}
+
+    // making this non-const would fail to compile below
+    int get_data() const override { return dataB_; }
+
+    MWE_DEFINE_DEVIRTUALIZED_ACTION(A, B, get_data, get_data_direct_action);
+
+protected:
+    int dataB_=0;
+};
+
+typedef hpx::components::simple_component<B> serverB_type;
+HPX_REGISTER_DERIVED_COMPONENT_FACTORY(serverB_type, B, "A");
+
+typedef B::get_data_direct_action b_get_data_direct_action;
+HPX_REGISTER_ACTION_DECLARATION(b_get_data_direct_action);
+HPX_REGISTER_ACTION(b_get_data_direct_action);
+
+///////////////////////////////////////////////////////////////////////////////
+// Component types are assigned at runtime, build the table on first use
+dispatch_table<int> const& get_data_dispatch()
+{
+    static dispatch_table<int> table = []()
+    {
+        dispatch_table<int> t;
+        t.add<A, get_data_direct_action>();
+        t.add<B, b_get_data_direct_action>();
+        return t;
+    }();
+    return table;
+}
+
+hpx::future<int> invoke_get_data_virtual(hpx::id_type const& id)
+{
+    return hpx::async<get_data_action>(id);
+}
+
+struct clientA
+  : hpx::components::client_base<clientA, A>
+{
+    typedef hpx::components::client_base<clientA, A>
+        base_type;
+
+    clientA() : get_data_(nullptr) {}
+    clientA(hpx::shared_future<hpx::id_type> const& id)
+      : base_type(id), get_data_(nullptr)
+    {}
+    clientA(hpx::id_type && id)
+      : base_type(std::move(id)), get_data_(nullptr)
+    {}
+
+    clientA(clientA const& rhs)
+      : base_type(rhs), get_data_(rhs.get_data_.load())
+    {}
+
+    clientA& operator=(clientA const& rhs)
+    {
+        base_type::operator=(rhs);
+        get_data_.store(rhs.get_data_.load());
+        return *this;
+    }
+
+    int get_data() const
+    {
+        return get_data_action()(this->get_id());
+    }
+
+    int get_data_devirtualized() const
+    {
+        // resolve the concrete type of the object only once, concurrent
+        // callers may resolve it as well but will find the same action
+        dispatch_table<int>::invoke_type f = get_data_.load();
+        if (f == nullptr)
+        {
+            hpx::components::component_type type =
+                hpx::agas::resolve(this->get_id()).get().type_;
+            f = get_data_dispatch().find(type, &invoke_get_data_virtual);
+            get_data_.store(f);
+        }
+        return f(this->get_id()).get();
+    }
+
+private:
+    mutable std::atomic<dispatch_table<int>::invoke_type> get_data_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+void test_devirtualized_dispatch(hpx::id_type const& loc)
+{
+    { // Client to A, instance of A
+        clientA obj = hpx::new_<clientA>(loc, 42);
+
+        HPX_TEST_EQ(obj.get_data(), 42);
+        HPX_TEST_EQ(obj.get_data_devirtualized(), 42);
+        HPX_TEST_EQ(obj.get_data_devirtualized(), 42);
+    }
+
+    { // Client to A, instance of B
+        clientA obj(hpx::components::new_<B>(loc, 43));
+
+        HPX_TEST_EQ(obj.get_data(), 43);
+        HPX_TEST_EQ(obj.get_data_devirtualized(), 43);
+        HPX_TEST_EQ(obj.get_data_devirtualized(), 43);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The raw calls are made through volatile function pointers, on an object
+// read through a volatile pointer, so that the compiler can neither inline
+// them, nor hoist them out of the loop, nor devirtualize the virtual one.
+HPX_NOINLINE int call_virtual(A const* a)
+{
+    return a->get_data_nonvirt();
+}
+
+HPX_NOINLINE int call_direct(A const* a)
+{
+    return static_cast<B const*>(a)->get_data_direct();
+}
+
+int (* volatile call_virtual_ptr)(A const*) = &call_virtual;
+int (* volatile call_direct_ptr)(A const*) = &call_direct;
+
+void benchmark_dispatch()
+{
+    std::size_t const num_calls = 100000;
+
+    clientA obj(hpx::components::new_<B>(hpx::find_here(), 42));
+    HPX_TEST_EQ(obj.get_data_devirtualized(), 42);
+
+    // full action round trip
+    hpx::util::high_resolution_timer t;
+    for (std::size_t i = 0; i != num_calls; ++i)
+        obj.get_data();
+    double virtual_action = t.elapsed();
+
+    t.restart();
+    for (std::size_t i = 0; i != num_calls; ++i)
+        obj.get_data_devirtualized();
+    double direct_action = t.elapsed();
+
+    // the dispatch itself, without the action overhead
+    std::shared_ptr<A> p = hpx::get_ptr<A>(obj.get_id()).get();
+    A const* volatile object = p.get();
+
+    int volatile sink = 0;
+
+    t.restart();
+    for (std::size_t i = 0; i != num_calls; ++i)
+        sink = call_virtual_ptr(object);
+    double virtual_call = t.elapsed();
+
+    t.restart();
+    for (std::size_t i = 0; i != num_calls; ++i)
+        sink = call_direct_ptr(object);
+    double direct_call = t.elapsed();
+
+    (void) sink;
+
+    hpx::cout
+        << "dispatch benchmark (" << num_calls << " calls, ns per call):\n"
+        << "  action, virtual:       " << 1e9 * virtual_action / num_calls
+        << "\n"
+        << "  action, devirtualized: " << 1e9 * direct_action / num_calls
+        << "\n"
+        << "  call, virtual:         " << 1e9 * virtual_call / num_calls
+        << "\n"
+        << "  call, devirtualized:   " << 1e9 * direct_call / num_calls
+        << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    for (hpx::id_type const& id : hpx::find_all_localities())
+        test_devirtualized_dispatch(id);
+
+    benchmark_dispatch();
+
+    return hpx::util::report_errors();
+}
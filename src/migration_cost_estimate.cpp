@@ -0,0 +1,292 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Dry-run cost estimate for migrating a component.
+//
+// A rebalancer needs to know what calling hpx::components::migrate would
+// cost before doing so. migration_cost_support adds get_migration_cost() to
+// a migratable component, which reports
+//
+//  - the number of bytes the component's serialize() would produce, measured
+//    with a counting archive which does not store any data,
+//  - the current pin count and the number of actions which have been
+//    scheduled but did not start running yet,
+//  - the expected time to ship the component to the given target.
+//
+// The link model used for the transfer time is configurable:
+//
+//     --hpx:ini=mwe.migration.bandwidth=<bytes per second>
+//     --hpx:ini=mwe.migration.latency=<seconds>
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include "migration_cost_support.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+struct A
+  : migration_cost_support<
+        hpx::components::component_base<A>
+    >
+{
+    typedef migration_cost_support<
+            hpx::components::component_base<A>
+        > base_type;
+
+    A()=default;
+    explicit A(int data) : dataA_(data) {}
+    virtual ~A() {}
+
+    hpx::id_type call() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return hpx::find_here();
+    }
+
+    void busy_work() const
+    {
+        HPX_TEST(pin_count() != 0);
+        hpx::this_thread::sleep_for(std::chrono::seconds(1));
+        HPX_TEST(pin_count() != 0);
+    }
+
+    virtual int get_data() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return dataA_;
+    }
+
+    int get_data_nonvirt() const { return get_data(); }
+
+    migration_cost estimate_migration(hpx::id_type const& target) const
+    {
+        return get_migration_cost(target);
+    }
+
+    A(A const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_)
+    {}
+
+    A(A && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_)
+    {}
+
+    A& operator=(A const & rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+    A& operator=(A && rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(A, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, busy_work, busy_work_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data_nonvirt, get_data_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, estimate_migration,
+        estimate_migration_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        ar & dataA_;
+    }
+    HPX_SERIALIZATION_POLYMORPHIC(A);
+
+protected:
+    int dataA_ = 0;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::call_action call_action;
+HPX_REGISTER_ACTION_DECLARATION(call_action);
+HPX_REGISTER_ACTION(call_action);
+
+typedef A::busy_work_action busy_work_action;
+HPX_REGISTER_ACTION_DECLARATION(busy_work_action);
+HPX_REGISTER_ACTION(busy_work_action);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+typedef A::estimate_migration_action estimate_migration_action;
+HPX_REGISTER_ACTION_DECLARATION(estimate_migration_action);
+HPX_REGISTER_ACTION(estimate_migration_action);
+
+struct B : A, hpx::components::component_base<B>
+{
+    using wrapping_type = hpx::components::component_base<B>::wrapping_type;
+    using wrapped_type  = hpx::components::component_base<B>::wrapped_type;
+
+    using type_holder = B;
+    using base_type_holder = A;
+
+    B()=default;
+    B(int data, std::size_t payload_size)
+      : dataB_(data), payload_(payload_size, 0.0)
+    {}
+    virtual ~B() {}
+
+    int get_data() const override
+    {
+        HPX_TEST(pin_count() != 0);
+        return dataB_;
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & hpx::serialization::base_object<A>(*this);
+        ar & dataB_ & payload_;
+    }
+    HPX_SERIALIZATION_POLYMORPHIC(B);
+protected:
+    int dataB_=0;
+    std::vector<double> payload_;
+};
+
+typedef hpx::components::simple_component<B> serverB_type;
+HPX_REGISTER_DERIVED_COMPONENT_FACTORY(serverB_type, B, "A");
+
+struct clientA
+  : hpx::components::client_base<clientA, A>
+{
+    typedef hpx::components::client_base<clientA, A>
+        base_type;
+
+    clientA() {}
+    clientA(hpx::shared_future<hpx::id_type> const& id) : base_type(id) {}
+    clientA(hpx::id_type && id) : base_type(std::move(id)) {}
+
+    hpx::id_type call() const
+    {
+        return call_action()(this->get_id());
+    }
+
+    hpx::future<void> busy_work() const
+    {
+        return hpx::async<busy_work_action>(this->get_id());
+    }
+
+    int get_data() const
+    {
+        return get_data_action()(this->get_id());
+    }
+
+    migration_cost estimate_migration(hpx::id_type const& target) const
+    {
+        return estimate_migration_action()(this->get_id(), target);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+void test_counting_archive()
+{
+    std::vector<int> data(1000, 42);
+
+    std::vector<char> buffer;
+    {
+        hpx::serialization::output_archive ar(buffer);
+        ar << data;
+    }
+
+    HPX_TEST_EQ(count_serialized_size(data), buffer.size());
+}
+
+bool test_estimate_migration(hpx::id_type source, hpx::id_type target)
+{
+    std::size_t const payload_size = 1000;
+
+    clientA a = hpx::new_<clientA>(source, 42);
+    clientA b(hpx::components::new_<B>(source, 42, payload_size));
+
+    try {
+        migration_cost cost_a = a.estimate_migration(target);
+        migration_cost cost_b = b.estimate_migration(target);
+
+        hpx::cout << "A: " << cost_a.serialized_size << " bytes, "
+            << cost_a.expected_transfer_time << "s; B: "
+            << cost_b.serialized_size << " bytes, "
+            << cost_b.expected_transfer_time << "s" << std::endl;
+
+        // the size of the dynamic type is reported
+        HPX_TEST_NEQ(cost_a.serialized_size, std::size_t(0));
+        HPX_TEST_LTE(cost_a.serialized_size + payload_size * sizeof(double),
+            cost_b.serialized_size);
+
+        // the estimate reports where the objects live
+        std::uint32_t source_locality =
+            hpx::naming::get_locality_id_from_id(source);
+        HPX_TEST_EQ(cost_a.locality, source_locality);
+        HPX_TEST_EQ(cost_b.locality, source_locality);
+
+        // nothing but the estimate itself is pinning the objects
+        HPX_TEST_EQ(cost_a.pin_count, 1u);
+        HPX_TEST_EQ(cost_b.pin_count, 1u);
+
+        if (source == target)
+        {
+            HPX_TEST_EQ(cost_b.expected_transfer_time, 0.0);
+        }
+        else
+        {
+            HPX_TEST_LT(0.0, cost_a.expected_transfer_time);
+            HPX_TEST_LT(cost_a.expected_transfer_time,
+                cost_b.expected_transfer_time);
+        }
+
+        // concurrent work shows up in the pin count
+        hpx::future<void> busy_work = b.busy_work();
+        hpx::this_thread::sleep_for(std::chrono::milliseconds(100));
+        HPX_TEST_LTE(2u, b.estimate_migration(target).pin_count);
+        busy_work.get();
+
+        // a dry run does not move anything
+        HPX_TEST_EQ(a.call(), source);
+        HPX_TEST_EQ(b.call(), source);
+        HPX_TEST_EQ(b.get_data(), 42);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    test_counting_archive();
+
+    hpx::cout << "test_estimate_migration: local" << std::endl;
+    HPX_TEST(test_estimate_migration(hpx::find_here(), hpx::find_here()));
+
+    std::vector<hpx::id_type> localities = hpx::find_remote_localities();
+
+    for (hpx::id_type const& id : localities)
+    {
+        hpx::cout << "test_estimate_migration: ->" << id << std::endl;
+        HPX_TEST(test_estimate_migration(hpx::find_here(), id));
+        hpx::cout << "test_estimate_migration: <-" << id << std::endl;
+        HPX_TEST(test_estimate_migration(id, hpx::find_here()));
+    }
+
+    return hpx::util::report_errors();
+}
@@ -0,0 +1,117 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Dry-run cost estimate for migrating a component, see
+// migration_cost_estimate.cpp.
+
+#if !defined(MWE_MIGRATION_COST_SUPPORT_HPP)
+#define MWE_MIGRATION_COST_SUPPORT_HPP
+
+#include <hpx/include/components.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/threads.hpp>
+#include <hpx/util/bind.hpp>
+#include <hpx/util/one_shot.hpp>
+
+#include "counting_archive.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+///////////////////////////////////////////////////////////////////////////////
+struct migration_cost
+{
+    migration_cost()
+      : locality(0), serialized_size(0), pin_count(0), queued_actions(0),
+        expected_transfer_time(0.0)
+    {}
+
+    std::uint32_t locality;         // where the object currently lives
+    std::size_t serialized_size;    // bytes produced by serialize()
+    std::uint32_t pin_count;        // includes the pin held by the query
+    std::size_t queued_actions;     // scheduled, but not running yet
+    double expected_transfer_time;  // seconds
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & locality & serialized_size & pin_count & queued_actions
+           & expected_transfer_time;
+    }
+};
+
+template <typename BaseComponent>
+struct migration_cost_support
+  : hpx::components::migration_support<BaseComponent>
+{
+private:
+    typedef hpx::components::migration_support<BaseComponent> base_type;
+    typedef typename base_type::this_component_type this_component_type;
+
+public:
+    template <typename ...Arg>
+    migration_cost_support(Arg &&... arg)
+      : base_type(std::forward<Arg>(arg)...)
+      , queued_actions_(0)
+    {}
+
+    // Estimate the cost of migrating this object to the given locality
+    // without migrating it.
+    migration_cost get_migration_cost(hpx::id_type const& target) const
+    {
+        migration_cost cost;
+        cost.locality = hpx::get_locality_id();
+
+        // this_component_type is polymorphic, so this measures the dynamic
+        // type of the object
+        cost.serialized_size = count_serialized_size(
+            static_cast<this_component_type const&>(*this));
+        cost.pin_count = this->pin_count();
+        cost.queued_actions = queued_actions_.load();
+
+        if (target != hpx::find_here())
+        {
+            double bandwidth = std::stod(hpx::get_config_entry(
+                "mwe.migration.bandwidth", "1e9"));
+            double latency = std::stod(hpx::get_config_entry(
+                "mwe.migration.latency", "5e-6"));
+
+            cost.expected_transfer_time =
+                latency + double(cost.serialized_size) / bandwidth;
+        }
+
+        return cost;
+    }
+
+    // Additionally to pinning the object (done by the base class), keep
+    // track of the actions which are waiting to be executed.
+    template <typename F>
+    static hpx::threads::thread_function_type
+    decorate_action(hpx::naming::address::address_type lva, F && f)
+    {
+        migration_cost_support* self =
+            hpx::get_lva<this_component_type>::call(lva);
+        ++self->queued_actions_;
+
+        return hpx::util::one_shot(hpx::util::bind(
+            &migration_cost_support::thread_function_queued, self,
+            hpx::util::placeholders::_1,
+            base_type::decorate_action(lva, std::forward<F>(f))));
+    }
+
+private:
+    hpx::threads::thread_result_type thread_function_queued(
+        hpx::threads::thread_state_ex_enum state,
+        hpx::threads::thread_function_type && f)
+    {
+        --queued_actions_;
+        return f(state);
+    }
+
+    std::atomic<std::size_t> queued_actions_;
+};
+
+#endif
@@ -0,0 +1,597 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Push-based location updates after migration.
+//
+// After a migration other localities still have the old address of the
+// component in their AGAS cache. Their next action goes to the old host and
+// has to be routed through AGAS again. With location pushing enabled,
+// migrate_and_publish asynchronously sends the new address of the component
+// to all localities which recently invoked actions on it, so that they can
+// update their caches before the next call.
+//
+// Every migration of a component increments its migration epoch, which is
+// sent along with the new address. A locality ignores pushed addresses older
+// than the newest one it has applied for that component, so an update which
+// is overtaken by a later migration can not make its cache stale again.
+//
+// Callers are recorded from the parent locality of the action's thread,
+// which requires HPX to be built with HPX_WITH_THREAD_PARENT_REFERENCE=On.
+// Without that information the new location is pushed to all localities.
+//
+// The mode is off by default and is enabled with
+//
+//     --hpx:ini=mwe.migration.push_location=1
+//
+// The number of pushes sent and cache updates applied is exposed through
+// the counters /migration/count/location-pushes and
+// /migration/count/location-updates. Stale routing shows up in the HPX
+// counters /parcels/count/routed (parcels which had to be routed through
+// AGAS) and /agas/count/route (parcels AGAS had to forward).
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/include/performance_counters.hpp>
+#include <hpx/runtime/agas/interface.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include "register_on_startup.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+std::atomic<std::int64_t> location_pushes(0);
+std::atomic<std::int64_t> location_updates(0);
+
+std::int64_t get_location_pushes(bool reset)
+{
+    return reset ? location_pushes.exchange(0) : location_pushes.load();
+}
+
+std::int64_t get_location_updates(bool reset)
+{
+    return reset ? location_updates.exchange(0) : location_updates.load();
+}
+
+void register_counter_types()
+{
+    hpx::performance_counters::install_counter_type(
+        "/migration/count/location-pushes", &get_location_pushes,
+        "returns the number of location updates sent by this locality after "
+        "a migration");
+    hpx::performance_counters::install_counter_type(
+        "/migration/count/location-updates", &get_location_updates,
+        "returns the number of pushed location updates applied to the AGAS "
+        "cache of this locality");
+}
+
+// the counters have to be known on every locality
+register_on_startup register_counter_types_on_startup_(&register_counter_types);
+
+///////////////////////////////////////////////////////////////////////////////
+// The newest migration epoch applied to the AGAS cache of this locality, per
+// component. Only the most recently updated components are remembered: an
+// update is overtaken by a later one within a short window only, and the
+// entries of components which stopped migrating would otherwise pile up.
+std::size_t const max_applied_epochs = 4096;
+
+struct applied_epoch
+{
+    std::uint64_t epoch;
+    std::uint64_t sequence;
+};
+
+hpx::lcos::local::spinlock applied_epochs_mtx;
+std::map<hpx::naming::gid_type, applied_epoch> applied_epochs;
+std::map<std::uint64_t, hpx::naming::gid_type> applied_epochs_order;
+std::uint64_t applied_epochs_sequence = 0;
+
+// Executed on the localities which recently talked to a migrated component
+void update_location(hpx::naming::gid_type const& gid,
+    hpx::naming::address const& addr, std::uint64_t epoch)
+{
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> l(applied_epochs_mtx);
+        std::uint64_t const sequence = ++applied_epochs_sequence;
+
+        auto it = applied_epochs.find(gid);
+        if (it != applied_epochs.end())
+        {
+            // a later migration has been published already
+            if (it->second.epoch >= epoch)
+                return;
+
+            applied_epochs_order.erase(it->second.sequence);
+            it->second = applied_epoch{epoch, sequence};
+        }
+        else
+        {
+            applied_epochs.emplace(gid, applied_epoch{epoch, sequence});
+
+            // forget the component which has not been updated for longest
+            if (applied_epochs.size() > max_applied_epochs)
+            {
+                auto oldest = applied_epochs_order.begin();
+                applied_epochs.erase(oldest->second);
+                applied_epochs_order.erase(oldest);
+            }
+        }
+        applied_epochs_order.emplace(sequence, gid);
+
+        hpx::agas::update_cache_entry(gid, addr);
+    }
+    ++location_updates;
+}
+HPX_PLAIN_ACTION(update_location, update_location_action);
+
+///////////////////////////////////////////////////////////////////////////////
+// Where a component lives now and who talked to it recently
+struct location_info
+{
+    hpx::naming::address addr;
+    std::uint64_t epoch = 0;
+    std::vector<std::uint32_t> callers;
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & addr & epoch & callers;
+    }
+};
+
+struct A
+  : hpx::components::migration_support<
+        hpx::components::component_base<A>
+    >
+{
+    typedef hpx::components::migration_support<
+            hpx::components::component_base<A>
+        > base_type;
+    typedef hpx::lcos::local::spinlock mutex_type;
+
+    // the number of callers remembered per component
+    static std::size_t const max_recent_callers = 8;
+
+    A()=default;
+    explicit A(int data) : dataA_(data) {}
+    virtual ~A() {}
+
+    hpx::id_type call() const
+    {
+        HPX_TEST(pin_count() != 0);
+        note_caller();
+        return hpx::find_here();
+    }
+
+    virtual int get_data() const
+    {
+        HPX_TEST(pin_count() != 0);
+        note_caller();
+        return dataA_;
+    }
+
+    int get_data_nonvirt() const { return get_data(); }
+
+    // Derived components have to report the address they are registered
+    // with, not the one of their A sub-object.
+    virtual hpx::naming::address current_address() const
+    {
+        return this->base_type::get_current_address();
+    }
+
+    location_info get_location_info() const
+    {
+        location_info info;
+        info.addr = current_address();
+        info.epoch = migration_epoch_;
+
+        std::lock_guard<mutex_type> l(mtx_);
+        info.callers = recent_callers_;
+        return info;
+    }
+
+    A(A const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_),
+        migration_epoch_(rhs.migration_epoch_),
+        recent_callers_(rhs.recent_callers_)
+    {}
+
+    A(A && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_),
+        migration_epoch_(rhs.migration_epoch_),
+        recent_callers_(std::move(rhs.recent_callers_))
+    {}
+
+    A& operator=(A const & rhs)
+    {
+        dataA_ = rhs.dataA_;
+        migration_epoch_ = rhs.migration_epoch_;
+        recent_callers_ = rhs.recent_callers_;
+        return *this;
+    }
+    A& operator=(A && rhs)
+    {
+        dataA_ = rhs.dataA_;
+        migration_epoch_ = rhs.migration_epoch_;
+        recent_callers_ = std::move(rhs.recent_callers_);
+        return *this;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(A, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data_nonvirt, get_data_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_location_info, get_location_info_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        // the callers move with the component, they are the ones which
+        // need to hear about the next migration
+        ar & dataA_ & migration_epoch_ & recent_callers_;
+        next_epoch(ar);
+    }
+    HPX_SERIALIZATION_POLYMORPHIC(A);
+
+protected:
+    // the object is only deserialized as part of a migration
+    void next_epoch(hpx::serialization::input_archive&)
+    {
+        ++migration_epoch_;
+    }
+    void next_epoch(hpx::serialization::output_archive&) {}
+
+    // Remember the locality which sent the currently running action
+    void note_caller() const
+    {
+        std::uint32_t caller = hpx::threads::get_parent_locality_id(
+            hpx::threads::get_self_id());
+        if (caller == hpx::naming::invalid_locality_id)
+            return;
+
+        std::lock_guard<mutex_type> l(mtx_);
+        auto it = std::find(
+            recent_callers_.begin(), recent_callers_.end(), caller);
+        if (it != recent_callers_.end())
+            recent_callers_.erase(it);
+        else if (recent_callers_.size() == max_recent_callers)
+            recent_callers_.erase(recent_callers_.begin());
+        recent_callers_.push_back(caller);
+    }
+
+    int dataA_ = 0;
+    std::uint64_t migration_epoch_ = 0;
+
+    mutable mutex_type mtx_;
+    mutable std::vector<std::uint32_t> recent_callers_;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::call_action call_action;
+HPX_REGISTER_ACTION_DECLARATION(call_action);
+HPX_REGISTER_ACTION(call_action);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+typedef A::get_location_info_action get_location_info_action;
+HPX_REGISTER_ACTION_DECLARATION(get_location_info_action);
+HPX_REGISTER_ACTION(get_location_info_action);
+
+struct B : A, hpx::components::component_base<B>
+{
+    using wrapping_type = hpx::components::component_base<B>::wrapping_type;
+    using wrapped_type  = hpx::components::component_base<B>::wrapped_type;
+
+    using type_holder = B;
+    using base_type_holder = A;
+
+    B()=default;
+    explicit B(int data) : dataB_(data) {}
+    virtual ~B() {}
+
+    int get_data() const override
+    {
+        HPX_TEST(pin_count() != 0);
+        note_caller();
+        return dataB_;
+    }
+
+    hpx::naming::address current_address() const override
+    {
+        return hpx::components::component_base<B>::get_current_address();
+    }
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & hpx::serialization::base_object<A>(*this);
+        ar & dataB_;
+    }
+    HPX_SERIALIZATION_POLYMORPHIC(B);
+protected:
+    int dataB_=0;
+};
+
+typedef hpx::components::simple_component<B> serverB_type;
+HPX_REGISTER_DERIVED_COMPONENT_FACTORY(serverB_type, B, "A");
+
+struct clientA
+  : hpx::components::client_base<clientA, A>
+{
+    typedef hpx::components::client_base<clientA, A>
+        base_type;
+
+    clientA() {}
+    clientA(hpx::shared_future<hpx::id_type> const& id) : base_type(id) {}
+    clientA(hpx::id_type && id) : base_type(std::move(id)) {}
+
+    hpx::id_type call() const
+    {
+        return call_action()(this->get_id());
+    }
+
+    int get_data() const
+    {
+        return get_data_action()(this->get_id());
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Send the new location of a migrated component to the localities which
+// recently talked to it. The returned future becomes ready once all updates
+// have been applied.
+hpx::future<void> publish_location(hpx::id_type const& id)
+{
+    return hpx::async<get_location_info_action>(id).then(
+        [id](hpx::future<location_info> && f)
+        {
+            location_info info = f.get();
+            std::vector<std::uint32_t> callers = std::move(info.callers);
+
+            // without parent information tell everybody
+            if (callers.empty())
+            {
+                for (hpx::id_type const& loc : hpx::find_all_localities())
+                {
+                    callers.push_back(
+                        hpx::naming::get_locality_id_from_id(loc));
+                }
+            }
+
+            // the initiator of the migration is likely to call again
+            if (std::find(callers.begin(), callers.end(),
+                    hpx::get_locality_id()) == callers.end())
+            {
+                callers.push_back(hpx::get_locality_id());
+            }
+
+            hpx::naming::gid_type gid =
+                hpx::naming::detail::get_stripped_gid(id.get_gid());
+            std::uint32_t new_host =
+                hpx::naming::get_locality_id_from_gid(info.addr.locality_);
+
+            std::vector<hpx::future<void> > updates;
+            for (std::uint32_t caller : callers)
+            {
+                // the new host knows where the object lives
+                if (caller == new_host)
+                    continue;
+
+                updates.push_back(hpx::async<update_location_action>(
+                    hpx::naming::get_id_from_locality_id(caller), gid,
+                    info.addr, info.epoch));
+                ++location_pushes;
+            }
+            return hpx::when_all(updates);
+        }).then(
+        [](hpx::future<std::vector<hpx::future<void> > > && f)
+        {
+            for (hpx::future<void>& update : f.get())
+                update.get();
+        });
+}
+
+// Publications which have been started but not been waited for yet
+hpx::lcos::local::spinlock publications_mtx;
+std::vector<hpx::future<void> > publications;
+
+// Wait for all outstanding publications, rethrows the first error
+void wait_for_publications()
+{
+    std::vector<hpx::future<void> > pending;
+    {
+        std::lock_guard<hpx::lcos::local::spinlock> l(publications_mtx);
+        std::swap(pending, publications);
+    }
+
+    hpx::wait_all(pending);
+    for (hpx::future<void>& f : pending)
+        f.get();
+}
+
+bool location_push_enabled = false;
+
+// Like hpx::components::migrate, but if location pushing is enabled the
+// completion of the migration asynchronously publishes the new location.
+clientA migrate_and_publish(clientA const& to_migrate,
+    hpx::id_type const& target)
+{
+    hpx::future<hpx::id_type> f =
+        hpx::components::migrate<A>(to_migrate.get_id(), target);
+    if (!location_push_enabled)
+        return clientA(std::move(f));
+
+    return clientA(f.then(
+        [](hpx::future<hpx::id_type> && f) -> hpx::id_type
+        {
+            hpx::id_type id = f.get();
+
+            hpx::future<void> p = publish_location(id);
+            std::lock_guard<hpx::lcos::local::spinlock> l(publications_mtx);
+            publications.push_back(std::move(p));
+            return id;
+        }));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Invoke some actions on the given object from the locality this runs on
+void touch(hpx::id_type const& id, std::size_t count)
+{
+    for (std::size_t i = 0; i != count; ++i)
+        HPX_TEST_EQ(get_data_action()(id), 42);
+}
+HPX_PLAIN_ACTION(touch, touch_action);
+
+std::int64_t query_counter(std::string const& name)
+{
+    hpx::performance_counters::performance_counter c(name);
+    return c.get_value<std::int64_t>().get();
+}
+
+struct routing_counts
+{
+    std::int64_t routed = 0;        // parcels sent with a stale address
+    std::int64_t forwarded = 0;     // parcels AGAS had to forward
+    std::int64_t pushes = 0;        // location updates sent
+    std::int64_t updates = 0;       // location updates applied
+};
+
+routing_counts query_routing_counts()
+{
+    routing_counts counts;
+    for (hpx::id_type const& loc : hpx::find_all_localities())
+    {
+        std::string instance = "{locality#" +
+            std::to_string(hpx::naming::get_locality_id_from_id(loc)) +
+            "/total}";
+
+        counts.routed += query_counter("/parcels" + instance + "/count/routed");
+        counts.forwarded += query_counter("/agas" + instance + "/count/route");
+        counts.pushes += query_counter(
+            "/migration" + instance + "/count/location-pushes");
+        counts.updates += query_counter(
+            "/migration" + instance + "/count/location-updates");
+    }
+    return counts;
+}
+
+// Migrate an object back and forth while all localities keep calling it,
+// returns the difference of the routing counters
+routing_counts run_ping_pong(hpx::id_type source, hpx::id_type target,
+    std::size_t iterations)
+{
+    std::vector<hpx::id_type> localities = hpx::find_all_localities();
+
+    clientA t1(hpx::components::new_<B>(source, 42));
+    HPX_TEST_EQ(t1.call(), source);
+
+    routing_counts before = query_routing_counts();
+
+    for (std::size_t i = 0; i != iterations; ++i)
+    {
+        clientA t2 = migrate_and_publish(t1, target);
+
+        // the migrated object should have the same id as before
+        HPX_TEST_EQ(t1.get_id(), t2.get_id());
+        HPX_TEST_EQ(t2.call(), target);
+
+        // measure the effect of updates which arrived in time
+        wait_for_publications();
+
+        // every locality talks to the object at its new location
+        std::vector<hpx::future<void> > calls;
+        for (hpx::id_type const& loc : localities)
+            calls.push_back(hpx::async<touch_action>(loc, t1.get_id(), 4));
+        hpx::wait_all(calls);
+
+        std::swap(source, target);
+    }
+
+    routing_counts after = query_routing_counts();
+
+    routing_counts result;
+    result.routed = after.routed - before.routed;
+    result.forwarded = after.forwarded - before.forwarded;
+    result.pushes = after.pushes - before.pushes;
+    result.updates = after.updates - before.updates;
+    return result;
+}
+
+// Restores the configured mode when a test is done
+struct restore_location_push
+{
+    restore_location_push() : configured_(location_push_enabled) {}
+    ~restore_location_push() { location_push_enabled = configured_; }
+
+    bool const configured_;
+};
+
+bool test_location_push(hpx::id_type source, hpx::id_type target)
+{
+    std::size_t const iterations = 20;
+    restore_location_push restore;
+
+    try {
+        location_push_enabled = false;
+        routing_counts without = run_ping_pong(source, target, iterations);
+
+        location_push_enabled = true;
+        routing_counts with = run_ping_pong(source, target, iterations);
+
+        hpx::cout
+            << "  without push: routed " << without.routed
+            << ", forwarded " << without.forwarded << "\n"
+            << "  with push:    routed " << with.routed
+            << ", forwarded " << with.forwarded
+            << ", pushes " << with.pushes
+            << ", updates " << with.updates << std::endl;
+
+        HPX_TEST_EQ(without.pushes, 0);
+        HPX_TEST_EQ(without.updates, 0);
+        HPX_TEST_LT(0, with.pushes);
+        HPX_TEST_LT(0, with.updates);
+
+        // the pushed locations spare the callers the detour through AGAS
+        HPX_TEST_LT(with.routed, without.routed);
+        HPX_TEST_LT(with.forwarded, without.forwarded);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    location_push_enabled = hpx::get_config_entry(
+        "mwe.migration.push_location", "0") != "0";
+
+    std::vector<hpx::id_type> localities = hpx::find_remote_localities();
+
+    for (hpx::id_type const& id : localities)
+    {
+        hpx::cout << "test_location_push: ->" << id << std::endl;
+        HPX_TEST(test_location_push(hpx::find_here(), id));
+        hpx::cout << "test_location_push: <-" << id << std::endl;
+        HPX_TEST(test_location_push(id, hpx::find_here()));
+    }
+
+    return hpx::util::report_errors();
+}
@@ -0,0 +1,765 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Bandwidth-budgeted migration scheduler with backpressure.
+//
+// Looping hpx::components::migrate over a rebalance plan puts all migration
+// parcels on the network at once and starves the application's own actions.
+// migration_scheduler queues the requested migrations and releases them per
+// (source, target) locality pair only as long as
+//
+//  - fewer than max_in_flight migrations of that pair are running, and
+//  - the pair has not exceeded its bandwidth budget, measured with the
+//    serialized size of the components (a token bucket).
+//
+// The scheduler is a template on the type of the migrated components. The
+// location and serialized size of each component are requested through a
+// cost function without blocking, the example uses the estimate of
+// migration_cost_support.
+//
+// The application reports the latencies of its own actions to the
+// scheduler. Whenever their moving average rises above latency_factor times
+// the best average seen so far the budgets are halved, otherwise they
+// slowly grow back to the configured values.
+//
+//     --hpx:ini=mwe.scheduler.max_in_flight=2
+//     --hpx:ini=mwe.scheduler.bandwidth=<bytes per second>
+//     --hpx:ini=mwe.scheduler.latency_factor=2.0
+//
+// The queue depth and the throughput in bytes per second are exposed as the
+// counters /migration/scheduler/queue-depth and
+// /migration/scheduler/throughput.
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/include/performance_counters.hpp>
+#include <hpx/util/function.hpp>
+#include <hpx/util/high_resolution_clock.hpp>
+#include <hpx/util/high_resolution_timer.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include "migration_cost_support.hpp"
+#include "register_on_startup.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+struct A
+  : migration_cost_support<
+        hpx::components::component_base<A>
+    >
+{
+    typedef migration_cost_support<
+            hpx::components::component_base<A>
+        > base_type;
+
+    A()=default;
+    A(int data, std::size_t payload_size)
+      : dataA_(data), payload_(payload_size, 1.0)
+    {}
+    virtual ~A() {}
+
+    hpx::id_type call() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return hpx::find_here();
+    }
+
+    int get_data() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return dataA_;
+    }
+
+    migration_cost estimate_migration(hpx::id_type const& target) const
+    {
+        return get_migration_cost(target);
+    }
+
+    A(A const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_), payload_(rhs.payload_)
+    {}
+
+    A(A && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_),
+        payload_(std::move(rhs.payload_))
+    {}
+
+    A& operator=(A const & rhs)
+    {
+        dataA_ = rhs.dataA_;
+        payload_ = rhs.payload_;
+        return *this;
+    }
+    A& operator=(A && rhs)
+    {
+        dataA_ = rhs.dataA_;
+        payload_ = std::move(rhs.payload_);
+        return *this;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(A, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data, get_data_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, estimate_migration,
+        estimate_migration_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        ar & dataA_ & payload_;
+    }
+
+protected:
+    int dataA_ = 0;
+    std::vector<double> payload_;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::call_action call_action;
+HPX_REGISTER_ACTION_DECLARATION(call_action);
+HPX_REGISTER_ACTION(call_action);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+typedef A::estimate_migration_action estimate_migration_action;
+HPX_REGISTER_ACTION_DECLARATION(estimate_migration_action);
+HPX_REGISTER_ACTION(estimate_migration_action);
+
+///////////////////////////////////////////////////////////////////////////////
+struct scheduler_config
+{
+    scheduler_config()
+      : max_in_flight(2), bandwidth(200e6), latency_factor(2.0)
+    {}
+
+    // concurrent migrations per locality pair
+    std::size_t max_in_flight;
+
+    // bytes per second per locality pair
+    double bandwidth;
+
+    // back off once application latency exceeds its best moving average by
+    // this factor
+    double latency_factor;
+
+    static scheduler_config from_config()
+    {
+        scheduler_config c;
+        c.max_in_flight = std::stoul(hpx::get_config_entry(
+            "mwe.scheduler.max_in_flight", std::to_string(c.max_in_flight)));
+        c.bandwidth = std::stod(hpx::get_config_entry(
+            "mwe.scheduler.bandwidth", std::to_string(c.bandwidth)));
+        c.latency_factor = std::stod(hpx::get_config_entry(
+            "mwe.scheduler.latency_factor", std::to_string(c.latency_factor)));
+        c.validate();
+        return c;
+    }
+
+    void validate() const
+    {
+        if (max_in_flight == 0)
+        {
+            HPX_THROW_EXCEPTION(hpx::bad_parameter,
+                "scheduler_config::validate",
+                "at least one migration has to be allowed in flight");
+        }
+
+        // the token buckets divide by the bandwidth, this rejects NaN too
+        if (!(bandwidth > 0.0))
+        {
+            HPX_THROW_EXCEPTION(hpx::bad_parameter,
+                "scheduler_config::validate",
+                "the bandwidth has to be positive");
+        }
+    }
+};
+
+// Schedules migrations of components of the given type. The cost function
+// reports where a component lives and how large it is, it is asked once per
+// scheduled migration.
+template <typename Component>
+class migration_scheduler
+  : public std::enable_shared_from_this<migration_scheduler<Component> >
+{
+public:
+    typedef hpx::util::function_nonser<
+            hpx::future<migration_cost>(
+                hpx::id_type const& component, hpx::id_type const& target)
+        > cost_function;
+
+private:
+    typedef hpx::lcos::local::spinlock mutex_type;
+    typedef std::pair<std::uint32_t, std::uint32_t> link_key;
+
+    struct request
+    {
+        hpx::id_type component;
+        hpx::id_type target;
+        std::size_t size;
+        hpx::lcos::local::promise<hpx::id_type> promise;
+    };
+
+    struct link
+    {
+        link() : in_flight(0), tokens(0.0), last_refill(now()) {}
+
+        std::deque<request> queue;
+        std::size_t in_flight;
+
+        // may become negative, a large component may exceed the budget
+        // once, the next one has to wait until it is paid off
+        double tokens;
+        std::uint64_t last_refill;
+    };
+
+public:
+    migration_scheduler(scheduler_config const& config, cost_function cost)
+      : config_(config)
+      , cost_(std::move(cost))
+      , scale_(1.0)
+      , latency_average_(0.0)
+      , best_latency_average_(std::numeric_limits<double>::max())
+      , last_backoff_(0)
+      , retry_pending_(false)
+      , peak_in_flight_(0)
+      , queued_(0)
+      , completed_bytes_(0)
+      , throughput_start_(now())
+    {
+        config_.validate();
+    }
+
+    // Queue the migration of the given component to the target, the
+    // returned future becomes ready once the migration is done. The request
+    // is queued as soon as its cost is known, this does not block.
+    hpx::future<hpx::id_type> schedule(hpx::id_type const& component,
+        hpx::id_type const& target)
+    {
+        ++queued_;
+
+        std::shared_ptr<migration_scheduler> self = this->shared_from_this();
+        return cost_(component, target).then(
+            [self, component, target](hpx::future<migration_cost> && f)
+            {
+                migration_cost cost;
+                try {
+                    cost = f.get();
+                }
+                catch (...) {
+                    --self->queued_;
+                    throw;
+                }
+
+                request r;
+                r.component = component;
+                r.target = target;
+                r.size = cost.serialized_size;
+                hpx::future<hpx::id_type> result = r.promise.get_future();
+
+                {
+                    std::lock_guard<mutex_type> l(self->mtx_);
+                    link_key key(cost.locality,
+                        hpx::naming::get_locality_id_from_id(target));
+                    self->links_[key].queue.push_back(std::move(r));
+                }
+
+                self->pump();
+                return result;
+            });
+    }
+
+    // Feed the latency of an application action into the backpressure
+    // control
+    void report_latency(double seconds)
+    {
+        double const alpha = 0.1;
+
+        std::lock_guard<mutex_type> l(mtx_);
+        latency_average_ = (latency_average_ == 0.0) ?
+            seconds : alpha * seconds + (1.0 - alpha) * latency_average_;
+        best_latency_average_ =
+            (std::min)(best_latency_average_, latency_average_);
+
+        if (latency_average_ > config_.latency_factor * best_latency_average_)
+        {
+            // multiplicative decrease, but give the previous decrease some
+            // time to take effect
+            std::uint64_t t = now();
+            if (t - last_backoff_ > 100000000)      // 100ms
+            {
+                scale_ = (std::max)(scale_ / 2.0, 1.0 / 16.0);
+                last_backoff_ = t;
+            }
+        }
+        else
+        {
+            // additive increase
+            scale_ = (std::min)(scale_ + 0.01, 1.0);
+        }
+    }
+
+    std::size_t queue_depth() const
+    {
+        return queued_.load();
+    }
+
+    // fraction of the configured budgets currently granted
+    double scale() const
+    {
+        std::lock_guard<mutex_type> l(mtx_);
+        return scale_;
+    }
+
+    // the largest number of concurrent migrations seen on any locality pair
+    std::size_t peak_in_flight() const
+    {
+        std::lock_guard<mutex_type> l(mtx_);
+        return peak_in_flight_;
+    }
+
+    // bytes per second migrated since the last reset
+    double throughput(bool reset)
+    {
+        std::uint64_t t = now();
+        std::uint64_t start = reset ?
+            throughput_start_.exchange(t) : throughput_start_.load();
+        std::uint64_t bytes = reset ?
+            completed_bytes_.exchange(0) : completed_bytes_.load();
+
+        return t == start ? 0.0 : double(bytes) * 1e9 / double(t - start);
+    }
+
+private:
+    static std::uint64_t now()
+    {
+        return hpx::util::high_resolution_clock::now();
+    }
+
+    // Start all migrations the budgets allow, arrange for a retry if
+    // some are only held back by the bandwidth budget
+    void pump()
+    {
+        std::vector<std::pair<link_key, request> > ready;
+        double retry_after = 0.0;
+
+        {
+            std::lock_guard<mutex_type> l(mtx_);
+
+            std::size_t const max_in_flight = (std::max)(std::size_t(1),
+                std::size_t(double(config_.max_in_flight) * scale_));
+            double const bandwidth = config_.bandwidth * scale_;
+            std::uint64_t const t = now();
+
+            for (auto& p : links_)
+            {
+                link& lnk = p.second;
+
+                // refill, allow a burst of at most 100ms worth of data
+                lnk.tokens = (std::min)(bandwidth * 0.1, lnk.tokens +
+                    bandwidth * double(t - lnk.last_refill) * 1e-9);
+                lnk.last_refill = t;
+
+                while (!lnk.queue.empty() && lnk.in_flight < max_in_flight &&
+                    lnk.tokens >= 0.0)
+                {
+                    lnk.tokens -= double(lnk.queue.front().size);
+                    ++lnk.in_flight;
+                    peak_in_flight_ =
+                        (std::max)(peak_in_flight_, lnk.in_flight);
+                    ready.emplace_back(p.first, std::move(lnk.queue.front()));
+                    lnk.queue.pop_front();
+                }
+
+                if (!lnk.queue.empty() && lnk.in_flight < max_in_flight)
+                {
+                    double wait = -lnk.tokens / bandwidth;
+                    retry_after = (retry_after == 0.0) ?
+                        wait : (std::min)(retry_after, wait);
+                }
+            }
+
+            if (retry_after > 0.0 && retry_pending_)
+                retry_after = 0.0;
+            else if (retry_after > 0.0)
+                retry_pending_ = true;
+        }
+
+        for (auto& p : ready)
+            launch(p.first, std::move(p.second));
+
+        if (retry_after > 0.0)
+        {
+            std::shared_ptr<migration_scheduler> self =
+                this->shared_from_this();
+            hpx::make_ready_future_after(std::chrono::microseconds(
+                    std::int64_t(retry_after * 1e6) + 1)).then(
+                [self](hpx::future<void> &&)
+                {
+                    {
+                        std::lock_guard<mutex_type> l(self->mtx_);
+                        self->retry_pending_ = false;
+                    }
+                    self->pump();
+                });
+        }
+    }
+
+    void launch(link_key const& key, request && r)
+    {
+        std::shared_ptr<migration_scheduler> self = this->shared_from_this();
+        std::size_t size = r.size;
+
+        hpx::components::migrate<Component>(r.component, r.target).then(
+            [self, key, size, promise = std::move(r.promise)](
+                hpx::future<hpx::id_type> && f) mutable
+            {
+                {
+                    std::lock_guard<mutex_type> l(self->mtx_);
+                    --self->links_[key].in_flight;
+                }
+                --self->queued_;
+                self->completed_bytes_ += size;
+
+                try {
+                    promise.set_value(f.get());
+                }
+                catch (...) {
+                    promise.set_exception(std::current_exception());
+                }
+
+                self->pump();
+            });
+    }
+
+    scheduler_config const config_;
+    cost_function const cost_;
+
+    mutable mutex_type mtx_;
+    std::map<link_key, link> links_;
+
+    // fraction of the configured budgets currently granted
+    double scale_;
+    double latency_average_;
+    double best_latency_average_;
+    std::uint64_t last_backoff_;
+    bool retry_pending_;
+    std::size_t peak_in_flight_;
+
+    // requested, but not yet completed migrations
+    std::atomic<std::size_t> queued_;
+    std::atomic<std::uint64_t> completed_bytes_;
+    std::atomic<std::uint64_t> throughput_start_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+hpx::future<migration_cost> estimate_migration(hpx::id_type const& component,
+    hpx::id_type const& target)
+{
+    return hpx::async<estimate_migration_action>(component, target);
+}
+
+std::shared_ptr<migration_scheduler<A> >& get_migration_scheduler()
+{
+    static std::shared_ptr<migration_scheduler<A> > scheduler =
+        std::make_shared<migration_scheduler<A> >(
+            scheduler_config::from_config(), &estimate_migration);
+    return scheduler;
+}
+
+std::int64_t get_queue_depth(bool)
+{
+    return std::int64_t(get_migration_scheduler()->queue_depth());
+}
+
+std::int64_t get_throughput(bool reset)
+{
+    return std::int64_t(get_migration_scheduler()->throughput(reset));
+}
+
+void register_counter_types()
+{
+    hpx::performance_counters::install_counter_type(
+        "/migration/scheduler/queue-depth", &get_queue_depth,
+        "returns the number of migrations requested through the scheduler "
+        "which did not complete yet");
+    hpx::performance_counters::install_counter_type(
+        "/migration/scheduler/throughput", &get_throughput,
+        "returns the number of bytes per second migrated by the scheduler",
+        "bytes/s");
+}
+
+// the counters have to be known on every locality
+register_on_startup register_counter_types_on_startup_(&register_counter_types);
+
+///////////////////////////////////////////////////////////////////////////////
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.0;
+
+    std::sort(values.begin(), values.end());
+    std::size_t index = std::size_t(p * double(values.size() - 1));
+    return values[index];
+}
+
+// Rebalance all given components to the target while the application keeps
+// calling app on the target, returns the application's action latencies
+std::vector<double> run_rebalance(std::vector<hpx::id_type> const& components,
+    hpx::id_type const& target, hpx::id_type const& app, bool budgeted)
+{
+    std::shared_ptr<migration_scheduler<A> > scheduler =
+        get_migration_scheduler();
+
+    std::atomic<bool> done(false);
+    std::vector<double> latencies;
+
+    // the application's timestep loop
+    hpx::future<void> application = hpx::async(
+        [&]()
+        {
+            while (!done.load())
+            {
+                hpx::util::high_resolution_timer t;
+                HPX_TEST_EQ(get_data_action()(app), 42);
+                double latency = t.elapsed();
+
+                latencies.push_back(latency);
+                if (budgeted)
+                    scheduler->report_latency(latency);
+            }
+        });
+
+    // let the application establish its baseline latency
+    hpx::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::vector<hpx::future<hpx::id_type> > migrated;
+    for (hpx::id_type const& id : components)
+    {
+        migrated.push_back(budgeted ?
+            scheduler->schedule(id, target) :
+            hpx::components::migrate<A>(id, target));
+    }
+
+    if (budgeted)
+    {
+        hpx::performance_counters::performance_counter depth(
+            "/migration/scheduler{locality#" +
+            std::to_string(hpx::get_locality_id()) + "/total}/queue-depth");
+        hpx::cout << "  queue depth after submitting: "
+            << depth.get_value<std::int64_t>().get() << std::endl;
+    }
+
+    hpx::wait_all(migrated);
+    done = true;
+    application.get();
+
+    for (std::size_t i = 0; i != migrated.size(); ++i)
+    {
+        HPX_TEST_EQ(migrated[i].get(), components[i]);
+        HPX_TEST_EQ(call_action()(components[i]), target);
+    }
+
+    return latencies;
+}
+
+bool test_migration_scheduler(hpx::id_type source, hpx::id_type target)
+{
+    std::size_t const num_components = 64;
+    std::size_t const payload_size = 1024 * 1024 / sizeof(double);
+
+    try {
+        hpx::id_type app = hpx::new_<A>(target, 42, std::size_t(0)).get();
+
+        double p99[2] = { 0.0, 0.0 };
+        for (bool budgeted : { false, true })
+        {
+            std::vector<hpx::id_type> components;
+            for (std::size_t i = 0; i != num_components; ++i)
+            {
+                components.push_back(
+                    hpx::new_<A>(source, int(i), payload_size).get());
+            }
+
+            hpx::util::high_resolution_timer t;
+            std::vector<double> latencies =
+                run_rebalance(components, target, app, budgeted);
+            double elapsed = t.elapsed();
+
+            p99[budgeted] = percentile(latencies, 0.99);
+
+            hpx::cout
+                << "  " << (budgeted ? "budgeted:   " : "unbudgeted: ")
+                << "rebalance " << elapsed << "s, application p50 "
+                << percentile(latencies, 0.5) * 1e6 << "us, p99 "
+                << p99[budgeted] * 1e6 << "us" << std::endl;
+        }
+
+        // everything which was scheduled has completed
+        HPX_TEST_EQ(get_migration_scheduler()->queue_depth(), std::size_t(0));
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Charge every migration with the given size instead of measuring it
+migration_scheduler<A>::cost_function fixed_cost(std::size_t size)
+{
+    return [size](hpx::id_type const& component, hpx::id_type const&)
+        {
+            return hpx::get_colocation_id(component).then(
+                [size](hpx::future<hpx::id_type> && f)
+                {
+                    migration_cost cost;
+                    cost.locality =
+                        hpx::naming::get_locality_id_from_id(f.get());
+                    cost.serialized_size = size;
+                    return cost;
+                });
+        };
+}
+
+std::vector<hpx::future<hpx::id_type> > schedule_all(
+    migration_scheduler<A>& scheduler, hpx::id_type const& source,
+    hpx::id_type const& target, std::size_t count)
+{
+    std::vector<hpx::future<hpx::id_type> > migrated;
+    for (std::size_t i = 0; i != count; ++i)
+    {
+        hpx::id_type id = hpx::new_<A>(source, int(i), std::size_t(0)).get();
+        migrated.push_back(scheduler.schedule(id, target));
+    }
+    return migrated;
+}
+
+// Checks of the budgets which do not depend on timing
+bool test_scheduler_budgets(hpx::id_type source, hpx::id_type target)
+{
+    try {
+        // no more than max_in_flight migrations of a pair run at a time
+        {
+            scheduler_config config;
+            config.max_in_flight = 2;
+            config.bandwidth = 1e15;
+
+            auto scheduler = std::make_shared<migration_scheduler<A> >(
+                config, fixed_cost(1));
+            std::vector<hpx::future<hpx::id_type> > migrated =
+                schedule_all(*scheduler, source, target, 16);
+            for (hpx::future<hpx::id_type>& f : migrated)
+                f.get();
+
+            HPX_TEST_LTE(std::size_t(1), scheduler->peak_in_flight());
+            HPX_TEST_LTE(scheduler->peak_in_flight(), config.max_in_flight);
+            HPX_TEST_EQ(scheduler->queue_depth(), std::size_t(0));
+        }
+
+        // the token bucket holds migrations back: after the first one each
+        // has to wait until the previous has been paid off
+        {
+            std::size_t const count = 6;
+            std::size_t const size = 1000000;
+
+            scheduler_config config;
+            config.max_in_flight = 16;
+            config.bandwidth = 10e6;
+
+            auto scheduler = std::make_shared<migration_scheduler<A> >(
+                config, fixed_cost(size));
+
+            hpx::util::high_resolution_timer t;
+            std::vector<hpx::future<hpx::id_type> > migrated =
+                schedule_all(*scheduler, source, target, count);
+            for (hpx::future<hpx::id_type>& f : migrated)
+                f.get();
+            double elapsed = t.elapsed();
+
+            double const minimum =
+                double((count - 1) * size) / config.bandwidth;
+            HPX_TEST_LTE(minimum, elapsed);
+        }
+
+        // a latency spike halves the budgets, once per 100ms
+        {
+            auto scheduler = std::make_shared<migration_scheduler<A> >(
+                scheduler_config(), fixed_cost(1));
+
+            scheduler->report_latency(1e-3);
+            HPX_TEST_EQ(scheduler->scale(), 1.0);
+
+            scheduler->report_latency(1.0);
+            HPX_TEST_EQ(scheduler->scale(), 0.5);
+
+            scheduler->report_latency(1.0);
+            HPX_TEST_EQ(scheduler->scale(), 0.5);
+        }
+
+        // invalid budgets are rejected
+        {
+            scheduler_config config;
+            config.bandwidth = 0.0;
+
+            bool caught_exception = false;
+            try {
+                migration_scheduler<A> scheduler(config, fixed_cost(1));
+            }
+            catch (hpx::exception const& e) {
+                caught_exception = e.get_error() == hpx::bad_parameter;
+            }
+            HPX_TEST(caught_exception);
+        }
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    std::vector<hpx::id_type> localities = hpx::find_remote_localities();
+    if (localities.empty())
+    {
+        hpx::cout << "the migration scheduler needs at least two localities"
+            << std::endl;
+    }
+
+    for (hpx::id_type const& id : localities)
+    {
+        hpx::cout << "test_scheduler_budgets: ->" << id << std::endl;
+        HPX_TEST(test_scheduler_budgets(hpx::find_here(), id));
+
+        hpx::cout << "test_migration_scheduler: ->" << id << std::endl;
+        HPX_TEST(test_migration_scheduler(hpx::find_here(), id));
+    }
+
+    return hpx::util::report_errors();
+}
@@ -0,0 +1,685 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Migrating a component between the NUMA domains of its own locality.
+//
+// hpx::components::migrate only knows about localities. numa_domain_target
+// names one of the NUMA domains of the locality the component lives on.
+// Relocating a component to such a target copies its state into memory
+// placed on that domain and binds all of its subsequent work to the worker
+// threads of that domain: every action of the component is re-dispatched to
+// that domain before it runs. The component object itself, and thus its
+// global id and AGAS address, stays where it is and nothing is serialized.
+//
+// The component is migratable to other localities as well. Its state is
+// sent as plain data and is bound to the same domain on the target
+// locality, if that locality has it, when the first action after the
+// migration runs.
+//
+// thread_pool_target names one of the thread pools of the locality instead.
+// Relocating a component to such a target leaves its state where it is and
+// runs all of its subsequent work on the worker threads of that pool. The
+// name of the pool is sent along with a migration as well.
+//
+// The NUMA domains are the ones reported by hpx::compute::host, i.e. the
+// hwloc NUMA nodes HPX worker threads are bound to. Run this with several
+// worker threads spanning more than one domain to see actual movement, e.g.
+//
+//     numa_domain_migration --hpx:threads=all --hpx:bind=balanced
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/include/compute.hpp>
+#include <hpx/include/threads.hpp>
+#include <hpx/include/resource_partitioner.hpp>
+#include <hpx/runtime/threads/executors/pool_executor.hpp>
+#include <hpx/runtime/agas/interface.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// A NUMA domain of the locality a component lives on
+struct numa_domain_target
+{
+    numa_domain_target() : domain(0) {}
+    explicit numa_domain_target(std::size_t d) : domain(d) {}
+
+    std::size_t domain;
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & domain;
+    }
+};
+
+std::vector<hpx::compute::host::target> const& numa_domains()
+{
+    static std::vector<hpx::compute::host::target> domains =
+        hpx::compute::host::get_numa_domains();
+    return domains;
+}
+
+// A thread pool of the locality a component lives on
+struct thread_pool_target
+{
+    thread_pool_target() {}
+    explicit thread_pool_target(std::string p) : pool(std::move(p)) {}
+
+    std::string pool;
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned)
+    {
+        ar & pool;
+    }
+};
+
+bool has_thread_pool(std::string const& pool)
+{
+    for (std::size_t i = 0; i != hpx::resource::get_num_thread_pools(); ++i)
+    {
+        if (hpx::resource::get_pool_name(i) == pool)
+            return true;
+    }
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+struct A
+  : hpx::components::migration_support<
+        hpx::components::component_base<A>
+    >
+{
+    typedef hpx::components::migration_support<
+            hpx::components::component_base<A>
+        > base_type;
+
+    typedef hpx::compute::host::block_allocator<int> allocator_type;
+    typedef hpx::compute::vector<int, allocator_type> payload_type;
+    typedef hpx::compute::host::block_executor<> executor_type;
+    typedef hpx::threads::executors::pool_executor pool_executor_type;
+    typedef hpx::lcos::local::spinlock mutex_type;
+    typedef hpx::lcos::local::mutex placement_mutex_type;
+
+    static std::size_t const default_payload_size = 1 << 20;
+
+    // the object is not bound to any domain
+    static std::size_t const no_domain = std::size_t(-1);
+
+    // used for deserialization, the state is placed once it is needed
+    A()
+      : domain_(no_domain)
+      , unplaced_(std::make_shared<std::vector<int> >())
+    {}
+
+    // until it is relocated the state is spread over all domains and the
+    // work runs wherever the action happens to be scheduled
+    explicit A(int data, std::size_t payload_size = default_payload_size)
+      : dataA_(data)
+      , domain_(no_domain)
+      , payload_(std::make_shared<payload_type>(
+            payload_size, 1, allocator_type(numa_domains())))
+    {}
+
+    A(A const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_)
+    {
+        std::lock_guard<mutex_type> l(rhs.mtx_);
+        domain_ = rhs.domain_;
+        pool_ = rhs.pool_;
+        payload_ = rhs.payload_;
+        exec_ = rhs.exec_;
+        pool_exec_ = rhs.pool_exec_;
+        unplaced_ = rhs.unplaced_;
+    }
+
+    A(A && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_)
+    {
+        std::lock_guard<mutex_type> l(rhs.mtx_);
+        domain_ = rhs.domain_;
+        pool_ = std::move(rhs.pool_);
+        payload_ = std::move(rhs.payload_);
+        exec_ = std::move(rhs.exec_);
+        pool_exec_ = std::move(rhs.pool_exec_);
+        unplaced_ = std::move(rhs.unplaced_);
+    }
+
+    // All actions below run on the domain or pool the component is bound to
+
+    hpx::future<hpx::id_type> call() const
+    {
+        return run([]() { return hpx::find_here(); });
+    }
+
+    hpx::future<int> get_data() const
+    {
+        int data = dataA_;
+        return run([data]() { return data; });
+    }
+
+    // The sum of the state
+    hpx::future<int> checksum() const
+    {
+        std::shared_ptr<payload_type const> payload = current_state().payload;
+        return run(
+            [payload]()
+            {
+                return std::accumulate(payload->begin(), payload->end(), 0);
+            });
+    }
+
+    // The worker thread the actions of this component run on
+    hpx::future<std::size_t> worker_thread() const
+    {
+        return run([]() { return hpx::get_worker_thread_num(); });
+    }
+
+    // The thread pool the actions of this component run on
+    hpx::future<std::string> thread_pool() const
+    {
+        return run(
+            []()
+            {
+                return hpx::this_thread::get_pool()->get_pool_name();
+            });
+    }
+
+    // Move the state of this component to the given domain, and run all
+    // further work there
+    void relocate(numa_domain_target const& target)
+    {
+        if (target.domain >= numa_domains().size())
+        {
+            HPX_THROW_EXCEPTION(hpx::bad_parameter, "A::relocate",
+                "the requested NUMA domain does not exist on this locality");
+        }
+
+        std::shared_ptr<payload_type const> old_payload =
+            current_state().payload;
+
+        std::lock_guard<placement_mutex_type> l(placement_mtx_);
+        place(old_payload->begin(), old_payload->end(), target.domain,
+            std::string());
+    }
+
+    // Run all further work of this component on the given thread pool, its
+    // state stays where it is
+    void relocate_to_pool(thread_pool_target const& target)
+    {
+        if (!has_thread_pool(target.pool))
+        {
+            HPX_THROW_EXCEPTION(hpx::bad_parameter, "A::relocate_to_pool",
+                "the requested thread pool does not exist on this locality");
+        }
+
+        // place state which arrived with a migration first
+        current_state();
+
+        auto pool_exec = std::make_shared<pool_executor_type>(target.pool);
+
+        std::lock_guard<placement_mutex_type> pl(placement_mtx_);
+        std::lock_guard<mutex_type> l(mtx_);
+        pool_ = target.pool;
+        pool_exec_ = std::move(pool_exec);
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(A, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data, get_data_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, checksum, checksum_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, worker_thread, worker_thread_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, thread_pool, thread_pool_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, relocate, relocate_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, relocate_to_pool, relocate_to_pool_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        ar & dataA_;
+        serialize_state(ar);
+    }
+
+private:
+    struct state_type
+    {
+        std::shared_ptr<payload_type const> payload;
+        std::shared_ptr<executor_type> exec;
+        std::shared_ptr<pool_executor_type> pool_exec;
+    };
+
+    // The block_allocator can not be sent to another locality, transfer the
+    // plain state, the index of the domain and the name of the pool instead.
+    // The object is bound to the same domain and pool on the target
+    // locality, if it has them.
+    void serialize_state(hpx::serialization::output_archive& ar) const
+    {
+        std::size_t domain = no_domain;
+        std::string pool;
+        std::shared_ptr<payload_type const> payload;
+        std::shared_ptr<std::vector<int> const> unplaced;
+        {
+            std::lock_guard<mutex_type> l(mtx_);
+            domain = domain_;
+            pool = pool_;
+            payload = payload_;
+            unplaced = unplaced_;
+        }
+
+        // the object may be migrated on before it has been placed here
+        if (unplaced)
+        {
+            ar & domain & pool & *unplaced;
+            return;
+        }
+
+        std::vector<int> data(payload->begin(), payload->end());
+        ar & domain & pool & data;
+    }
+
+    // Placing the state waits for the executor of the domain, which must
+    // not happen while the parcel is being decoded. Keep the plain state
+    // until the first action needs it.
+    void serialize_state(hpx::serialization::input_archive& ar)
+    {
+        std::size_t domain = no_domain;
+        std::string pool;
+        auto data = std::make_shared<std::vector<int> >();
+        ar & domain & pool & *data;
+
+        if (domain >= numa_domains().size())
+            domain = no_domain;
+        if (!pool.empty() && !has_thread_pool(pool))
+            pool.clear();
+
+        std::lock_guard<mutex_type> l(mtx_);
+        domain_ = domain;
+        pool_ = std::move(pool);
+        payload_.reset();
+        exec_.reset();
+        pool_exec_.reset();
+        unplaced_ = std::move(data);
+    }
+
+    // Copy the given state into memory on the given domain, and bind all
+    // further work to it, or to the given pool if one is named. Has to be
+    // called with placement_mtx_ held.
+    template <typename Iterator>
+    void place(Iterator first, Iterator last, std::size_t domain,
+        std::string const& pool) const
+    {
+        std::size_t size = std::distance(first, last);
+        std::shared_ptr<executor_type> exec;
+
+        std::shared_ptr<payload_type> new_payload;
+        if (domain == no_domain)
+        {
+            new_payload = std::make_shared<payload_type>(
+                size, allocator_type(numa_domains()));
+            std::copy(first, last, new_payload->begin());
+        }
+        else
+        {
+            std::vector<hpx::compute::host::target> targets(
+                1, numa_domains()[domain]);
+            exec = std::make_shared<executor_type>(targets);
+
+            // the allocator places (first touches) the new state on the
+            // target domain, copy into it from there as well
+            new_payload = std::make_shared<payload_type>(
+                size, allocator_type(targets));
+            hpx::async(*exec,
+                [&first, &last, &new_payload]()
+                {
+                    std::copy(first, last, new_payload->begin());
+                }).get();
+        }
+
+        std::shared_ptr<pool_executor_type> pool_exec;
+        if (!pool.empty())
+            pool_exec = std::make_shared<pool_executor_type>(pool);
+
+        std::lock_guard<mutex_type> l(mtx_);
+        domain_ = domain;
+        pool_ = pool;
+        payload_ = std::move(new_payload);
+        exec_ = std::move(exec);
+        pool_exec_ = std::move(pool_exec);
+        unplaced_.reset();
+    }
+
+    // Run the given function on the pool or the domain this object is bound
+    // to, the pool takes precedence
+    template <typename F>
+    hpx::future<typename std::result_of<F()>::type> run(F && f) const
+    {
+        state_type state = current_state();
+        if (state.pool_exec)
+            return hpx::async(*state.pool_exec, std::forward<F>(f));
+        if (state.exec)
+            return hpx::async(*state.exec, std::forward<F>(f));
+        return hpx::make_ready_future(f());
+    }
+
+    // work which is already running keeps the state it started with alive
+    state_type current_state() const
+    {
+        {
+            std::lock_guard<mutex_type> l(mtx_);
+            if (!unplaced_)
+                return state_type{payload_, exec_, pool_exec_};
+        }
+
+        // the state arrived with a migration, place it now
+        std::lock_guard<placement_mutex_type> pl(placement_mtx_);
+
+        std::shared_ptr<std::vector<int> const> unplaced;
+        std::size_t domain = no_domain;
+        std::string pool;
+        {
+            std::lock_guard<mutex_type> l(mtx_);
+            unplaced = unplaced_;
+            domain = domain_;
+            pool = pool_;
+        }
+        if (unplaced)
+            place(unplaced->begin(), unplaced->end(), domain, pool);
+
+        std::lock_guard<mutex_type> l(mtx_);
+        return state_type{payload_, exec_, pool_exec_};
+    }
+
+    int dataA_ = 0;
+
+    // the state is placed lazily after a migration, see current_state
+    mutable mutex_type mtx_;
+    mutable placement_mutex_type placement_mtx_;
+    mutable std::size_t domain_;
+    mutable std::string pool_;
+    mutable std::shared_ptr<payload_type const> payload_;
+    mutable std::shared_ptr<executor_type> exec_;
+    mutable std::shared_ptr<pool_executor_type> pool_exec_;
+    mutable std::shared_ptr<std::vector<int> const> unplaced_;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::call_action call_action;
+HPX_REGISTER_ACTION_DECLARATION(call_action);
+HPX_REGISTER_ACTION(call_action);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+typedef A::checksum_action checksum_action;
+HPX_REGISTER_ACTION_DECLARATION(checksum_action);
+HPX_REGISTER_ACTION(checksum_action);
+
+typedef A::worker_thread_action worker_thread_action;
+HPX_REGISTER_ACTION_DECLARATION(worker_thread_action);
+HPX_REGISTER_ACTION(worker_thread_action);
+
+typedef A::thread_pool_action thread_pool_action;
+HPX_REGISTER_ACTION_DECLARATION(thread_pool_action);
+HPX_REGISTER_ACTION(thread_pool_action);
+
+typedef A::relocate_action relocate_action;
+HPX_REGISTER_ACTION_DECLARATION(relocate_action);
+HPX_REGISTER_ACTION(relocate_action);
+
+typedef A::relocate_to_pool_action relocate_to_pool_action;
+HPX_REGISTER_ACTION_DECLARATION(relocate_to_pool_action);
+HPX_REGISTER_ACTION(relocate_to_pool_action);
+
+// Counterpart of hpx::components::migrate for NUMA domain targets
+template <typename Component>
+hpx::future<hpx::id_type> migrate(hpx::id_type const& to_migrate,
+    numa_domain_target const& target)
+{
+    typedef typename Component::relocate_action action_type;
+    return hpx::async<action_type>(to_migrate, target).then(
+        [to_migrate](hpx::future<void> && f) -> hpx::id_type
+        {
+            f.get();
+            return to_migrate;
+        });
+}
+
+// Counterpart of hpx::components::migrate for thread pool targets
+template <typename Component>
+hpx::future<hpx::id_type> migrate(hpx::id_type const& to_migrate,
+    thread_pool_target const& target)
+{
+    typedef typename Component::relocate_to_pool_action action_type;
+    return hpx::async<action_type>(to_migrate, target).then(
+        [to_migrate](hpx::future<void> && f) -> hpx::id_type
+        {
+            f.get();
+            return to_migrate;
+        });
+}
+
+struct clientA
+  : hpx::components::client_base<clientA, A>
+{
+    typedef hpx::components::client_base<clientA, A>
+        base_type;
+
+    clientA() {}
+    clientA(hpx::shared_future<hpx::id_type> const& id) : base_type(id) {}
+    clientA(hpx::id_type && id) : base_type(std::move(id)) {}
+
+    hpx::id_type call() const
+    {
+        return call_action()(this->get_id()).get();
+    }
+
+    int get_data() const
+    {
+        return get_data_action()(this->get_id()).get();
+    }
+
+    int checksum() const
+    {
+        return checksum_action()(this->get_id()).get();
+    }
+
+    std::size_t worker_thread() const
+    {
+        return worker_thread_action()(this->get_id()).get();
+    }
+
+    std::string thread_pool() const
+    {
+        return thread_pool_action()(this->get_id()).get();
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Whether the given worker thread of this locality is bound to a core of the
+// given domain
+bool is_on_domain(std::size_t worker_thread, numa_domain_target const& target)
+{
+    hpx::threads::mask_type domain_mask =
+        numa_domains()[target.domain].native_handle().get_device();
+    hpx::threads::mask_cref_type thread_mask =
+        hpx::threads::get_topology().get_thread_affinity_mask(worker_thread);
+    return hpx::threads::bit_and(domain_mask, thread_mask);
+}
+
+bool test_numa_domain_migration()
+{
+    std::size_t const num_domains = numa_domains().size();
+    hpx::cout << "test_numa_domain_migration: " << num_domains
+        << " NUMA domain(s)" << std::endl;
+
+    if (num_domains == 0)
+        return true;
+
+    clientA t1 = hpx::new_<clientA>(hpx::find_here(), 42);
+    HPX_TEST_NEQ(hpx::naming::invalid_id, t1.get_id());
+
+    int const expected_checksum = int(A::default_payload_size);
+    HPX_TEST_EQ(t1.checksum(), expected_checksum);
+
+    hpx::naming::address before = hpx::agas::resolve(t1.get_id()).get();
+
+    try {
+        // move the object through all domains and back to the first one
+        for (std::size_t i = 0; i <= num_domains; ++i)
+        {
+            numa_domain_target target(i % num_domains);
+            hpx::id_type t2 = migrate<A>(t1.get_id(), target).get();
+            HPX_TEST_EQ(t1.get_id(), t2);
+
+            // the actions of the object should run on the target now
+            HPX_TEST(is_on_domain(t1.worker_thread(), target));
+
+            // the state should have moved along
+            HPX_TEST_EQ(t1.get_data(), 42);
+            HPX_TEST_EQ(t1.checksum(), expected_checksum);
+        }
+
+        // the object itself did not move
+        hpx::naming::address after = hpx::agas::resolve(t1.get_id()).get();
+        HPX_TEST(before.locality_ == after.locality_);
+        HPX_TEST_EQ(before.address_, after.address_);
+        HPX_TEST_EQ(t1.call(), hpx::find_here());
+
+        // relocating to a domain this locality does not have fails
+        bool caught_exception = false;
+        try {
+            migrate<A>(t1.get_id(), numa_domain_target(num_domains)).get();
+        }
+        catch (hpx::exception const&) {
+            caught_exception = true;
+        }
+        HPX_TEST(caught_exception);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool test_thread_pool_migration()
+{
+    std::size_t const num_pools = hpx::resource::get_num_thread_pools();
+    hpx::cout << "test_thread_pool_migration: " << num_pools
+        << " thread pool(s)" << std::endl;
+
+    clientA t1 = hpx::new_<clientA>(hpx::find_here(), 42);
+
+    int const expected_checksum = int(A::default_payload_size);
+
+    try {
+        // move the object through all pools
+        for (std::size_t i = 0; i != num_pools; ++i)
+        {
+            thread_pool_target target(hpx::resource::get_pool_name(i));
+            hpx::id_type t2 = migrate<A>(t1.get_id(), target).get();
+            HPX_TEST_EQ(t1.get_id(), t2);
+
+            // the actions of the object should run on the target now
+            HPX_TEST_EQ(t1.thread_pool(), target.pool);
+
+            HPX_TEST_EQ(t1.get_data(), 42);
+            HPX_TEST_EQ(t1.checksum(), expected_checksum);
+        }
+
+        // relocating to a pool this locality does not have fails
+        bool caught_exception = false;
+        try {
+            migrate<A>(t1.get_id(),
+                thread_pool_target("no-such-pool")).get();
+        }
+        catch (hpx::exception const& e) {
+            caught_exception = (e.get_error() == hpx::bad_parameter);
+        }
+        HPX_TEST(caught_exception);
+
+        // the object is still bound to the last pool
+        HPX_TEST_EQ(t1.thread_pool(),
+            hpx::resource::get_pool_name(num_pools - 1));
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// A relocated object can still be migrated to other localities, it takes
+// the index of its domain along
+bool test_migrate_relocated_component(hpx::id_type source,
+    hpx::id_type target)
+{
+    clientA t1 = hpx::new_<clientA>(source, 42);
+    HPX_TEST_EQ(t1.call(), source);
+
+    int const expected_checksum = int(A::default_payload_size);
+
+    try {
+        migrate<A>(t1.get_id(), numa_domain_target(0)).get();
+
+        hpx::id_type t2 =
+            hpx::components::migrate<A>(t1.get_id(), target).get();
+        HPX_TEST_EQ(t1.get_id(), t2);
+
+        HPX_TEST_EQ(t1.call(), target);
+        HPX_TEST_EQ(t1.get_data(), 42);
+        HPX_TEST_EQ(t1.checksum(), expected_checksum);
+
+        // the binding to a pool travels along as well
+        migrate<A>(t1.get_id(), thread_pool_target("default")).get();
+        hpx::components::migrate<A>(t1.get_id(), source).get();
+
+        HPX_TEST_EQ(t1.call(), source);
+        HPX_TEST_EQ(t1.thread_pool(), std::string("default"));
+        HPX_TEST_EQ(t1.checksum(), expected_checksum);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    HPX_TEST(test_numa_domain_migration());
+    HPX_TEST(test_thread_pool_migration());
+
+    for (hpx::id_type const& id : hpx::find_remote_localities())
+    {
+        hpx::cout << "test_migrate_relocated_component: ->" << id
+            << std::endl;
+        HPX_TEST(test_migrate_relocated_component(hpx::find_here(), id));
+        hpx::cout << "test_migrate_relocated_component: <-" << id
+            << std::endl;
+        HPX_TEST(test_migrate_relocated_component(id, hpx::find_here()));
+    }
+
+    return hpx::util::report_errors();
+}
@@ -0,0 +1,21 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(MWE_REGISTER_ON_STARTUP_HPP)
+#define MWE_REGISTER_ON_STARTUP_HPP
+
+#include <hpx/include/runtime.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// Run the given function during the startup of every locality, e.g. to
+// install counter types which have to be known everywhere. Meant to be
+// instantiated at namespace scope.
+struct register_on_startup
+{
+    explicit register_on_startup(void (*f)())
+    {
+        hpx::register_startup_function(f);
+    }
+};
+
+#endif
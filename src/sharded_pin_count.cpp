@@ -0,0 +1,786 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Contention-free pin counting for heavily accessed migratable components.
+//
+// hpx::components::migration_support keeps a single pin counter protected by
+// a spinlock. Every action pins and unpins the component, so many worker
+// threads hammering one component keep bouncing that cache line between
+// cores. sharded_migration_support below keeps one padded counter per worker
+// thread instead. Pinning and unpinning a component which is not being
+// migrated touches only the counter of the calling thread; the shards are
+// summed (and the AGAS migration table consulted) only while a migration of
+// the object is pending.
+//
+// Before pinning, migration_support looks every incoming action up in the
+// AGAS table of migrated objects, which is protected by one mutex per
+// locality. sharded_migration_support skips that lookup as long as no
+// object of the same type has a migration pending on this locality, so the
+// pinning benchmark below compares the stock path, including that mutex,
+// against a path taking no lock at all.
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/include/threads.hpp>
+#include <hpx/runtime/agas/interface.hpp>
+#include <hpx/runtime/components/pinned_ptr.hpp>
+#include <hpx/util/high_resolution_timer.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// One counter per worker thread (plus one for all other threads), each on a
+// cache line of its own
+class sharded_counters
+{
+    static std::size_t const cache_line_size = 64;
+
+public:
+    struct shard
+    {
+        shard() : count_(0), busy_(0) {}
+
+        std::atomic<std::int64_t> count_;
+
+        // number of threads currently on the fast path of this shard
+        std::atomic<std::uint32_t> busy_;
+    };
+    static_assert(sizeof(shard) <= cache_line_size,
+        "a shard has to fit into a cache line");
+
+    sharded_counters()
+      : num_shards_(hpx::get_os_thread_count() + 1)
+        // std::allocator does not honour over-alignment in C++14, align the
+        // shards to cache lines by hand
+      , storage_(new char[(num_shards_ + 1) * cache_line_size])
+    {
+        std::uintptr_t p = reinterpret_cast<std::uintptr_t>(storage_.get());
+        shards_ = reinterpret_cast<char*>(
+            (p + cache_line_size - 1) & ~std::uintptr_t(cache_line_size - 1));
+
+        for (std::size_t i = 0; i != num_shards_; ++i)
+            new (shards_ + i * cache_line_size) shard();
+    }
+
+    ~sharded_counters()
+    {
+        for (std::size_t i = 0; i != num_shards_; ++i)
+            get(i).~shard();
+    }
+
+    sharded_counters(sharded_counters const&) = delete;
+    sharded_counters& operator=(sharded_counters const&) = delete;
+
+    shard& local() const
+    {
+        std::size_t num_thread = hpx::get_worker_thread_num();
+        if (num_thread >= num_shards_ - 1)
+            return get(num_shards_ - 1);
+        return get(num_thread);
+    }
+
+    // Wait for all threads which are on the fast path of any shard. The
+    // remaining fast paths only have a couple of instructions left, don't
+    // suspend (the caller may hold a lock).
+    void drain() const
+    {
+        for (std::size_t i = 0; i != num_shards_; ++i)
+        {
+            while (get(i).busy_.load() != 0)
+                /**/;
+        }
+    }
+
+    // Only exact while no thread is on the fast path
+    std::int64_t sum() const
+    {
+        std::int64_t result = 0;
+        for (std::size_t i = 0; i != num_shards_; ++i)
+            result += get(i).count_.load();
+        return result;
+    }
+
+private:
+    shard& get(std::size_t i) const
+    {
+        return *reinterpret_cast<shard*>(shards_ + i * cache_line_size);
+    }
+
+    std::size_t const num_shards_;
+    std::unique_ptr<char[]> storage_;
+    char* shards_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template <typename BaseComponent>
+struct sharded_migration_support
+  : hpx::components::migration_support<BaseComponent>
+{
+private:
+    typedef hpx::components::migration_support<BaseComponent> base_type;
+    typedef typename base_type::this_component_type this_component_type;
+    typedef hpx::lcos::local::spinlock mutex_type;
+
+public:
+    template <typename ...Arg>
+    sharded_migration_support(Arg &&... arg)
+      : base_type(std::forward<Arg>(arg)...)
+      , slow_path_(0)
+      , migration_requested_(false)
+      , migrated_(false)
+      , was_marked_for_migration_(false)
+    {}
+
+    ~sharded_migration_support()
+    {
+        // prevent base destructor from unregistering the gid if this
+        // instance has been migrated
+        if (migrated_)
+        {
+            hpx::naming::gid_type gid = this->gid_;
+            this->gid_ = hpx::naming::invalid_gid;
+            end_pending_migration(gid);
+        }
+    }
+
+    // The stock migration_support looks every incoming action up in the
+    // AGAS table of migrated objects, which is protected by a single mutex
+    // per locality, and pins the object while holding it. Components of this
+    // type skip the table as long as no object of this type on this
+    // locality has a migration pending. The flag of the object itself can
+    // not be used for that: the object behind lva may have been migrated
+    // away and destroyed already.
+    static std::pair<bool, hpx::components::pinned_ptr>
+    was_object_migrated(hpx::naming::gid_type const& id,
+        hpx::naming::address::address_type lva)
+    {
+        sharded_counters::shard& s = type_gate().local();
+        s.busy_.fetch_add(1);
+        if (pending_migrations().load() == 0)
+        {
+            // a migration which starts now waits for this pin to show up
+            hpx::components::pinned_ptr p =
+                hpx::components::pinned_ptr::create<this_component_type>(lva);
+            s.busy_.fetch_sub(1);
+            return std::make_pair(false, std::move(p));
+        }
+        s.busy_.fetch_sub(1);
+
+        return base_type::was_object_migrated(id, lva);
+    }
+
+    // On the fast path a thread only touches the shard of the worker thread
+    // it runs on. Pins are allowed to be released on a different thread
+    // than the one which acquired them, so an individual shard may become
+    // negative; only the sum is meaningful.
+    //
+    // Whenever the exact sum is needed (a migration is pending, or the pin
+    // count is queried) slow_path_ is raised and all threads already on the
+    // fast path are waited for. Every later update is done under mtx_.
+    void pin()
+    {
+        HPX_ASSERT(!migrated_);
+
+        sharded_counters::shard& s = shards_.local();
+        s.busy_.fetch_add(1);
+        if (slow_path_.load() == 0)
+        {
+            s.count_.fetch_add(1);
+            s.busy_.fetch_sub(1);
+            return;
+        }
+        s.busy_.fetch_sub(1);
+
+        std::lock_guard<mutex_type> l(mtx_);
+        s.count_.fetch_add(1);
+    }
+
+    bool unpin()
+    {
+        sharded_counters::shard& s = shards_.local();
+        s.busy_.fetch_add(1);
+        if (slow_path_.load() == 0)
+        {
+            s.count_.fetch_sub(1);
+            s.busy_.fetch_sub(1);
+            return false;
+        }
+        s.busy_.fetch_sub(1);
+
+        return unpin_slow();
+    }
+
+    // This blocks the fast path of all threads for a moment, use it for
+    // diagnostics only.
+    std::uint32_t pin_count() const
+    {
+        std::lock_guard<mutex_type> l(mtx_);
+        if (migrated_)
+            return ~0x0u;
+
+        enter_slow_path();
+        std::int64_t result = shards_.sum();
+        leave_slow_path();
+
+        return static_cast<std::uint32_t>(result);
+    }
+
+    // Whether pinning this object currently takes the locked path
+    bool is_on_slow_path() const
+    {
+        return slow_path_.load() != 0;
+    }
+
+    void mark_as_migrated()
+    {
+        std::lock_guard<mutex_type> l(mtx_);
+        HPX_ASSERT(migration_requested_ && 1 == shards_.sum());
+        migrated_ = true;
+    }
+
+    hpx::future<void> mark_as_migrated(hpx::id_type const& to_migrate)
+    {
+        // divert new actions on objects of this type to the AGAS table,
+        // and wait for the ones which have decided to skip it
+        begin_pending_migration();
+
+        // we need to first lock the AGAS migrated objects table, only then
+        // access (lock) the object
+        bool called = false;
+        hpx::future<void> f = hpx::agas::mark_as_migrated(
+            to_migrate.get_gid(),
+            [this, &called]() mutable -> std::pair<bool, hpx::future<void> >
+            {
+                called = true;
+                std::unique_lock<mutex_type> l(mtx_);
+
+                // make sure that no migration is currently in flight
+                if (was_marked_for_migration_)
+                {
+                    l.unlock();
+                    pending_migrations().fetch_sub(1);
+                    return std::make_pair(false,
+                        hpx::make_exceptional_future<void>(
+                            HPX_GET_EXCEPTION(hpx::invalid_status,
+                                "sharded_migration_support::mark_as_migrated",
+                                "migration operation is already in progress")));
+                }
+
+                // from now on this instance is counted exactly, until the
+                // migration is done or has been aborted
+                if (!migration_requested_)
+                {
+                    migration_requested_ = true;
+                    enter_slow_path();
+                }
+                else
+                {
+                    // an earlier request which did not complete is still
+                    // accounted for
+                    pending_migrations().fetch_sub(1);
+                }
+
+                // the migration operation itself holds one pin
+                if (1 == shards_.sum())
+                {
+                    // all is well, migration can proceed
+                    return std::make_pair(true, hpx::make_ready_future());
+                }
+
+                // delay migrate operation until only its own pin is left
+                was_marked_for_migration_ = true;
+                hpx::future<void> trigger = trigger_migration_.get_future();
+
+                l.unlock();
+                return std::make_pair(true, std::move(trigger));
+            });
+
+        // AGAS refused to mark the object without asking it
+        if (!called)
+            pending_migrations().fetch_sub(1);
+
+        return f;
+    }
+
+    // Called if the migration of this object has been aborted, the object
+    // goes back to the fast path
+    void unmark_as_migrated()
+    {
+        std::lock_guard<mutex_type> l(mtx_);
+        if (!migration_requested_)
+            return;
+
+        migration_requested_ = false;
+        migrated_ = false;
+        was_marked_for_migration_ = false;
+        trigger_migration_ = hpx::lcos::local::promise<void>();
+
+        leave_slow_path();
+        pending_migrations().fetch_sub(1);
+    }
+
+private:
+    // The number of objects of this type on this locality which have been
+    // marked for migration and may still be in the AGAS table of migrated
+    // objects
+    static std::atomic<std::size_t>& pending_migrations()
+    {
+        static std::atomic<std::size_t> pending(0);
+        return pending;
+    }
+
+    // Threads deciding whether to skip the AGAS table
+    static sharded_counters& type_gate()
+    {
+        static sharded_counters gate;
+        return gate;
+    }
+
+    static void begin_pending_migration()
+    {
+        pending_migrations().fetch_add(1);
+        type_gate().drain();
+    }
+
+    // The entry of a migrated object is removed from the AGAS table only
+    // after the object has been destroyed, until then actions sent to its
+    // old address still have to be looked up there
+    static void end_pending_migration(hpx::naming::gid_type const& gid)
+    {
+        if (!hpx::is_running())
+        {
+            pending_migrations().fetch_sub(1);
+            return;
+        }
+
+        hpx::apply(
+            [gid]()
+            {
+                while (hpx::agas::was_object_migrated(gid,
+                        []() { return hpx::components::pinned_ptr(); }).first)
+                {
+                    hpx::this_thread::sleep_for(
+                        std::chrono::milliseconds(1));
+                }
+                pending_migrations().fetch_sub(1);
+            });
+    }
+
+    // Divert all threads to the slow path and wait for the ones which are
+    // still on the fast path. Has to be called with mtx_ held.
+    void enter_slow_path() const
+    {
+        slow_path_.fetch_add(1);
+        shards_.drain();
+    }
+
+    void leave_slow_path() const
+    {
+        slow_path_.fetch_sub(1);
+    }
+
+    bool unpin_slow()
+    {
+        // make sure to always grab the AGAS lock first
+        bool was_migrated = false;
+        hpx::agas::mark_as_migrated(this->gid_,
+            [this, &was_migrated]() mutable
+                -> std::pair<bool, hpx::future<void> >
+            {
+                std::unique_lock<mutex_type> l(mtx_);
+                was_migrated = migrated_;
+                if (!migrated_)
+                {
+                    shards_.local().count_.fetch_sub(1);
+
+                    // trigger pending migration if only the pin of the
+                    // migration operation is left
+                    if (was_marked_for_migration_ && shards_.sum() == 1)
+                    {
+                        was_marked_for_migration_ = false;
+
+                        hpx::lcos::local::promise<void> p;
+                        std::swap(p, trigger_migration_);
+                        l.unlock();
+                        p.set_value();
+                        return std::make_pair(true, hpx::make_ready_future());
+                    }
+                }
+                return std::make_pair(false, hpx::make_ready_future());
+            }).get();
+
+        return was_migrated;
+    }
+
+    sharded_counters shards_;
+
+    // non-zero while the exact pin count is needed
+    mutable std::atomic<std::uint32_t> slow_path_;
+
+    mutable mutex_type mtx_;
+    bool migration_requested_;
+    bool migrated_;
+    bool was_marked_for_migration_;
+    hpx::lcos::local::promise<void> trigger_migration_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Reference component using the stock (spinlock protected) pin counter
+struct A
+  : hpx::components::migration_support<
+        hpx::components::component_base<A>
+    >
+{
+    typedef hpx::components::migration_support<
+            hpx::components::component_base<A>
+        > base_type;
+
+    A()=default;
+    explicit A(int data) : dataA_(data) {}
+    virtual ~A() {}
+
+    hpx::id_type call() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return hpx::find_here();
+    }
+
+    int get_data() const { return dataA_; }
+
+    A(A const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_)
+    {}
+
+    A(A && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_)
+    {}
+
+    A& operator=(A const & rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+    A& operator=(A && rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(A, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data, get_data_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        ar & dataA_;
+    }
+
+protected:
+    int dataA_ = 0;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::call_action call_action;
+HPX_REGISTER_ACTION_DECLARATION(call_action);
+HPX_REGISTER_ACTION(call_action);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+///////////////////////////////////////////////////////////////////////////////
+// Same component, but pinned through the sharded counters
+struct SA
+  : sharded_migration_support<
+        hpx::components::component_base<SA>
+    >
+{
+    typedef sharded_migration_support<
+            hpx::components::component_base<SA>
+        > base_type;
+
+    SA()=default;
+    explicit SA(int data) : dataA_(data) {}
+    virtual ~SA() {}
+
+    hpx::id_type call() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return hpx::find_here();
+    }
+
+    int get_data() const { return dataA_; }
+
+    // keeps the object pinned for a while
+    int busy_work() const
+    {
+        hpx::this_thread::sleep_for(std::chrono::seconds(1));
+        return dataA_;
+    }
+
+    SA(SA const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_)
+    {}
+
+    SA(SA && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_)
+    {}
+
+    SA& operator=(SA const & rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+    SA& operator=(SA && rhs)
+    {
+        dataA_ = rhs.dataA_;
+        return *this;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(SA, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(SA, get_data, get_data_action);
+    HPX_DEFINE_COMPONENT_ACTION(SA, busy_work, busy_work_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        ar & dataA_;
+    }
+
+protected:
+    int dataA_ = 0;
+};
+
+typedef hpx::components::simple_component<SA> sharded_server_type;
+HPX_REGISTER_COMPONENT(sharded_server_type, SA);
+
+typedef SA::call_action sharded_call_action;
+HPX_REGISTER_ACTION_DECLARATION(sharded_call_action);
+HPX_REGISTER_ACTION(sharded_call_action);
+
+typedef SA::get_data_action sharded_get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(sharded_get_data_action);
+HPX_REGISTER_ACTION(sharded_get_data_action);
+
+typedef SA::busy_work_action sharded_busy_work_action;
+HPX_REGISTER_ACTION_DECLARATION(sharded_busy_work_action);
+HPX_REGISTER_ACTION(sharded_busy_work_action);
+
+///////////////////////////////////////////////////////////////////////////////
+bool test_migrate_sharded_component(hpx::id_type source, hpx::id_type target)
+{
+    // create component on given locality
+    hpx::id_type t1 = hpx::new_<SA>(source, 42).get();
+    HPX_TEST_NEQ(hpx::naming::invalid_id, t1);
+
+    // the new object should live on the source locality
+    HPX_TEST_EQ(sharded_call_action()(t1), source);
+    HPX_TEST_EQ(sharded_get_data_action()(t1), 42);
+
+    std::vector<hpx::future<int> > work;
+
+    try {
+        // migrate t1 back and forth between source and target, keeping the
+        // object busy while it is being migrated
+        hpx::id_type here = source;
+        hpx::id_type there = target;
+        for (std::size_t i = 0; i != 10; ++i)
+        {
+            for (std::size_t j = 0; j != 100; ++j)
+                work.push_back(hpx::async<sharded_get_data_action>(t1));
+
+            hpx::id_type t2 = hpx::components::migrate<SA>(t1, there).get();
+
+            // the migrated object should have the same id as before
+            HPX_TEST_EQ(t1, t2);
+
+            // the migrated object should live on the new locality now
+            HPX_TEST_EQ(sharded_call_action()(t2), there);
+            HPX_TEST_EQ(sharded_get_data_action()(t2), 42);
+
+            std::swap(here, there);
+        }
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    for (hpx::future<int>& f : work)
+        HPX_TEST_EQ(f.get(), 42);
+
+    return true;
+}
+
+// A migration requested while an action is running on the object has to be
+// deferred until that action has released its pin
+bool test_migrate_pinned_sharded_component(hpx::id_type source,
+    hpx::id_type target)
+{
+    hpx::id_type t1 = hpx::new_<SA>(source, 42).get();
+    HPX_TEST_NEQ(hpx::naming::invalid_id, t1);
+    HPX_TEST_EQ(sharded_call_action()(t1), source);
+
+    hpx::future<int> busy = hpx::async<sharded_busy_work_action>(t1);
+
+    // make sure busy_work has started (and pinned the object)
+    hpx::this_thread::sleep_for(std::chrono::milliseconds(100));
+    HPX_TEST(!busy.is_ready());
+
+    try {
+        hpx::id_type t2 = hpx::components::migrate<SA>(t1, target).get();
+        HPX_TEST_EQ(t1, t2);
+
+        // the migration could not have finished before busy_work did
+        HPX_TEST(busy.is_ready());
+        HPX_TEST_EQ(busy.get(), 42);
+
+        HPX_TEST_EQ(sharded_call_action()(t2), target);
+        HPX_TEST_EQ(sharded_get_data_action()(t2), 42);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// An aborted migration puts the object back on the fast path
+bool test_abort_migration(hpx::id_type const& target)
+{
+    hpx::id_type t1 = hpx::new_<SA>(hpx::find_here(), 42).get();
+    std::shared_ptr<SA> p = hpx::get_ptr<SA>(t1).get();
+
+    HPX_TEST(!p->is_on_slow_path());
+
+    try {
+        // do what hpx::components::migrate does before it gives up, p holds
+        // the pin of the migration operation
+        p->mark_as_migrated(t1).get();
+        HPX_TEST(p->is_on_slow_path());
+
+        hpx::agas::unmark_as_migrated(t1.get_gid());
+        p->unmark_as_migrated();
+        HPX_TEST(!p->is_on_slow_path());
+
+        // the object is still fully functional
+        HPX_TEST_EQ(sharded_get_data_action()(t1), 42);
+        HPX_TEST(!p->is_on_slow_path());
+
+        if (target != hpx::find_here())
+        {
+            p.reset();
+            hpx::id_type t2 = hpx::components::migrate<SA>(t1, target).get();
+            HPX_TEST_EQ(t1, t2);
+            HPX_TEST_EQ(sharded_call_action()(t2), target);
+        }
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Run num_tasks concurrent loops of num_calls actions each against the same
+// component, returns the achieved actions per second
+template <typename Action>
+double measure_actions_per_second(hpx::id_type const& id,
+    std::size_t num_tasks, std::size_t num_calls)
+{
+    hpx::util::high_resolution_timer t;
+
+    std::vector<hpx::future<void> > tasks;
+    tasks.reserve(num_tasks);
+    for (std::size_t i = 0; i != num_tasks; ++i)
+    {
+        tasks.push_back(hpx::async(
+            [id, num_calls]()
+            {
+                std::vector<hpx::future<int> > calls;
+                calls.reserve(num_calls);
+                for (std::size_t j = 0; j != num_calls; ++j)
+                    calls.push_back(hpx::async<Action>(id));
+                hpx::wait_all(calls);
+            }));
+    }
+    hpx::wait_all(tasks);
+
+    return double(num_tasks * num_calls) / t.elapsed();
+}
+
+void benchmark_pinning()
+{
+    std::size_t const num_tasks = hpx::get_os_thread_count();
+    std::size_t const num_calls = 10000;
+
+    hpx::id_type a = hpx::new_<A>(hpx::find_here(), 42).get();
+    hpx::id_type sa = hpx::new_<SA>(hpx::find_here(), 42).get();
+
+    // warm up
+    measure_actions_per_second<get_data_action>(a, num_tasks, 100);
+    measure_actions_per_second<sharded_get_data_action>(sa, num_tasks, 100);
+
+    double locked =
+        measure_actions_per_second<get_data_action>(a, num_tasks, num_calls);
+    double sharded = measure_actions_per_second<sharded_get_data_action>(
+        sa, num_tasks, num_calls);
+
+    hpx::cout
+        << "pinning benchmark (" << num_tasks << " threads, "
+        << num_calls << " actions each, one component):\n"
+        << "  migration_support (AGAS table mutex, spinlock): "
+        << locked << " actions/s\n"
+        << "  sharded_migration_support (no lock):           "
+        << sharded << " actions/s\n"
+        << "  speedup:                                        "
+        << sharded / locked
+        << std::endl;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    std::vector<hpx::id_type> localities = hpx::find_remote_localities();
+
+    hpx::cout << "test_abort_migration" << std::endl;
+    HPX_TEST(test_abort_migration(
+        localities.empty() ? hpx::find_here() : localities.front()));
+
+    for (hpx::id_type const& id : localities)
+    {
+        hpx::cout << "test_migrate_sharded_component: ->" << id << std::endl;
+        HPX_TEST(test_migrate_sharded_component(hpx::find_here(), id));
+        hpx::cout << "test_migrate_sharded_component: <-" << id << std::endl;
+        HPX_TEST(test_migrate_sharded_component(id, hpx::find_here()));
+
+        hpx::cout << "test_migrate_pinned_sharded_component: ->" << id
+            << std::endl;
+        HPX_TEST(test_migrate_pinned_sharded_component(hpx::find_here(), id));
+        hpx::cout << "test_migrate_pinned_sharded_component: <-" << id
+            << std::endl;
+        HPX_TEST(test_migrate_pinned_sharded_component(id, hpx::find_here()));
+    }
+
+    benchmark_pinning();
+
+    return hpx::util::report_errors();
+}
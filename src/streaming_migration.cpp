@@ -0,0 +1,616 @@
+//  Distributed under the Boost Software License, Version 1.0. (See accompanying
+//  file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+
+// Pipelined, chunked migration of very large components.
+//
+// hpx::components::migrate builds the complete serialize() output of the
+// component in memory, ships it, and deserializes it as a whole on the
+// target. For components holding hundreds of MB this means a large
+// transient buffer on both sides and no overlap between the steps.
+//
+// migrate_streaming instead first streams the bulk state of the component
+// to the target in fixed-size chunks. The chunks are sent zero-copy
+// straight out of the component's memory, at most max_in_flight of them at
+// a time, and the target copies each one into place as it arrives. Only
+// then the component is migrated the usual way, which keeps its global id,
+// but its serialize() now only carries a handle to the already staged
+// state which the new instance adopts. The handle is only valid for the
+// locality the state was streamed to: a migration to any other locality
+// fails, and migrate_streaming drops the handle if its migration fails.
+//
+// The sizes used can be set on the command line:
+//
+//     --hpx:ini=mwe.migration.payload_mb=64
+//     --hpx:ini=mwe.migration.chunk_kb=1024
+//     --hpx:ini=mwe.migration.max_in_flight=4
+//
+// Peak RSS only ever grows, so to compare both paths cleanly run them in
+// separate processes with --hpx:ini=mwe.migration.mode=stream|classic
+// (the default, both, runs the streaming path first).
+
+#include <hpx/hpx_main.hpp>
+#include <hpx/include/components.hpp>
+#include <hpx/include/actions.hpp>
+#include <hpx/include/serialization.hpp>
+#include <hpx/include/lcos.hpp>
+#include <hpx/include/iostreams.hpp>
+#include <hpx/util/high_resolution_timer.hpp>
+#include <hpx/util/lightweight_test.hpp>
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// The state of components streamed to this locality, waiting to be adopted
+// by their migrated instance
+struct staged_state
+{
+    std::vector<double> data;
+    std::size_t received = 0;
+};
+
+typedef hpx::lcos::local::mutex staging_mutex_type;
+
+staging_mutex_type& staging_mutex()
+{
+    static staging_mutex_type mtx;
+    return mtx;
+}
+
+std::map<std::uint64_t, staged_state>& staging_area()
+{
+    static std::map<std::uint64_t, staged_state> area;
+    return area;
+}
+
+// Receive one chunk of a streamed state
+void stage_chunk(std::uint64_t transfer, std::size_t total,
+    std::size_t offset, hpx::serialization::serialize_buffer<double> chunk)
+{
+    double* dest = nullptr;
+    {
+        std::lock_guard<staging_mutex_type> l(staging_mutex());
+        staged_state& s = staging_area()[transfer];
+        if (s.data.size() != total)
+            s.data.resize(total);
+        dest = s.data.data();
+    }
+
+    // the storage does not move anymore and chunks do not overlap
+    std::copy(chunk.data(), chunk.data() + chunk.size(), dest + offset);
+
+    std::lock_guard<staging_mutex_type> l(staging_mutex());
+    staging_area()[transfer].received += chunk.size();
+}
+HPX_PLAIN_ACTION(stage_chunk, stage_chunk_action);
+
+// Hand the completely received state of a transfer to its new owner
+std::vector<double> take_staged(std::uint64_t transfer)
+{
+    std::lock_guard<staging_mutex_type> l(staging_mutex());
+
+    auto it = staging_area().find(transfer);
+    if (it == staging_area().end() ||
+        it->second.received != it->second.data.size())
+    {
+        HPX_THROW_EXCEPTION(hpx::invalid_status, "take_staged",
+            "the streamed state of this component is not complete");
+    }
+
+    std::vector<double> data = std::move(it->second.data);
+    staging_area().erase(it);
+    return data;
+}
+
+// Drop the staged state of a transfer which will not be completed
+void discard_staged(std::uint64_t transfer)
+{
+    std::lock_guard<staging_mutex_type> l(staging_mutex());
+    staging_area().erase(transfer);
+}
+HPX_PLAIN_ACTION(discard_staged, discard_staged_action);
+
+std::uint64_t next_transfer_id()
+{
+    static std::atomic<std::uint32_t> counter(0);
+    return (std::uint64_t(hpx::get_locality_id()) << 32) | ++counter;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+struct A
+  : hpx::components::migration_support<
+        hpx::components::component_base<A>
+    >
+{
+    typedef hpx::components::migration_support<
+            hpx::components::component_base<A>
+        > base_type;
+    typedef hpx::serialization::serialize_buffer<double> buffer_type;
+
+    A()=default;
+    A(int data, std::size_t payload_size)
+      : dataA_(data), payload_(payload_size)
+    {
+        for (std::size_t i = 0; i != payload_size; ++i)
+            payload_[i] = double(i % 1000);
+    }
+    virtual ~A() {}
+
+    hpx::id_type call() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return hpx::find_here();
+    }
+
+    int get_data() const
+    {
+        HPX_TEST(pin_count() != 0);
+        return dataA_;
+    }
+
+    double checksum() const
+    {
+        HPX_TEST(pin_count() != 0);
+        double sum = 0.0;
+        for (double d : payload_)
+            sum += d;
+        return sum;
+    }
+
+    // Send the payload to the target in chunks of chunk_size elements with
+    // at most max_in_flight chunks outstanding. The next migration of this
+    // object only carries a handle to the streamed payload, and has to go to
+    // the target. The payload must not be modified until the object has been
+    // migrated. Returns the id of the transfer, or zero if there was nothing
+    // to stream.
+    std::uint64_t stream_to(hpx::id_type const& target, std::size_t chunk_size,
+        std::size_t max_in_flight)
+    {
+        HPX_TEST(pin_count() != 0);
+        if (chunk_size == 0)
+        {
+            HPX_THROW_EXCEPTION(hpx::bad_parameter, "A::stream_to",
+                "the chunk size must not be zero");
+        }
+        if (max_in_flight == 0)
+        {
+            HPX_THROW_EXCEPTION(hpx::bad_parameter, "A::stream_to",
+                "at least one chunk has to be allowed in flight");
+        }
+        if (streamed_transfer_ != 0)
+        {
+            HPX_THROW_EXCEPTION(hpx::invalid_status, "A::stream_to",
+                "the payload has already been streamed");
+        }
+
+        // an empty payload is cheaper to ship with the object itself
+        std::size_t const total = payload_.size();
+        if (total == 0)
+            return 0;
+
+        std::uint64_t transfer = next_transfer_id();
+
+        std::deque<hpx::future<void> > in_flight;
+        try {
+            for (std::size_t offset = 0; offset < total; offset += chunk_size)
+            {
+                if (in_flight.size() == max_in_flight)
+                {
+                    hpx::future<void> f = std::move(in_flight.front());
+                    in_flight.pop_front();
+                    f.get();
+                }
+
+                // the chunks are serialized straight out of the payload
+                std::size_t count = (std::min)(chunk_size, total - offset);
+                in_flight.push_back(hpx::async<stage_chunk_action>(
+                    target, transfer, total, offset,
+                    buffer_type(payload_.data() + offset, count,
+                        buffer_type::reference)));
+            }
+
+            while (!in_flight.empty())
+            {
+                hpx::future<void> f = std::move(in_flight.front());
+                in_flight.pop_front();
+                f.get();
+            }
+        }
+        catch (...) {
+            // the chunks reference the payload, let them finish
+            hpx::wait_all(in_flight.begin(), in_flight.end());
+            discard_staged_action()(target, transfer);
+            throw;
+        }
+
+        streamed_transfer_ = transfer;
+        streamed_to_ = hpx::naming::get_locality_id_from_id(target);
+        return transfer;
+    }
+
+    // Fail if the payload has been streamed to a locality other than the
+    // given migration target
+    void check_migration_target(hpx::id_type const& target) const
+    {
+        if (streamed_transfer_ != 0 &&
+            streamed_to_ != hpx::naming::get_locality_id_from_id(target))
+        {
+            HPX_THROW_EXCEPTION(hpx::invalid_status,
+                "A::check_migration_target",
+                "the payload of this component has been streamed to "
+                "another locality");
+        }
+    }
+
+    // Forget about a streamed payload, the next migration ships it again.
+    // The staged state on the target has to be discarded separately.
+    void cancel_stream(std::uint64_t transfer)
+    {
+        if (streamed_transfer_ == transfer)
+        {
+            streamed_transfer_ = 0;
+            streamed_to_ = hpx::naming::invalid_locality_id;
+        }
+    }
+
+    A(A const& rhs)
+      : base_type(rhs), dataA_(rhs.dataA_), payload_(rhs.payload_),
+        streamed_transfer_(rhs.streamed_transfer_),
+        streamed_to_(rhs.streamed_to_)
+    {}
+
+    A(A && rhs)
+      : base_type(std::move(rhs)), dataA_(rhs.dataA_),
+        payload_(std::move(rhs.payload_)),
+        streamed_transfer_(rhs.streamed_transfer_),
+        streamed_to_(rhs.streamed_to_)
+    {}
+
+    A& operator=(A const & rhs)
+    {
+        dataA_ = rhs.dataA_;
+        payload_ = rhs.payload_;
+        streamed_transfer_ = rhs.streamed_transfer_;
+        streamed_to_ = rhs.streamed_to_;
+        return *this;
+    }
+    A& operator=(A && rhs)
+    {
+        dataA_ = rhs.dataA_;
+        payload_ = std::move(rhs.payload_);
+        streamed_transfer_ = rhs.streamed_transfer_;
+        streamed_to_ = rhs.streamed_to_;
+        return *this;
+    }
+
+    HPX_DEFINE_COMPONENT_ACTION(A, call, call_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, get_data, get_data_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, checksum, checksum_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, stream_to, stream_to_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, check_migration_target,
+        check_migration_target_action);
+    HPX_DEFINE_COMPONENT_ACTION(A, cancel_stream, cancel_stream_action);
+
+    template <typename Archive>
+    void serialize(Archive& ar, unsigned version)
+    {
+        ar & dataA_ & streamed_transfer_ & streamed_to_;
+        if (streamed_transfer_ == 0)
+        {
+            ar & payload_;
+        }
+        else if (std::is_same<Archive,
+                    hpx::serialization::input_archive>::value)
+        {
+            // the handle is only good for the locality the state went to,
+            // migrate_checked makes sure this does not happen
+            if (streamed_to_ != hpx::get_locality_id())
+            {
+                HPX_THROW_EXCEPTION(hpx::invalid_status, "A::serialize",
+                    "the payload of this component has been streamed to "
+                    "another locality");
+            }
+
+            // adopt the state which was streamed here beforehand, the
+            // migrated instance does not keep the handle
+            payload_ = take_staged(streamed_transfer_);
+            streamed_transfer_ = 0;
+            streamed_to_ = hpx::naming::invalid_locality_id;
+        }
+    }
+
+protected:
+    int dataA_ = 0;
+    std::vector<double> payload_;
+
+    // non-zero if the payload has been streamed ahead of the migration, and
+    // the locality it has been streamed to
+    std::uint64_t streamed_transfer_ = 0;
+    std::uint32_t streamed_to_ = hpx::naming::invalid_locality_id;
+};
+
+typedef hpx::components::simple_component<A> server_type;
+HPX_REGISTER_COMPONENT(server_type, A);
+
+typedef A::call_action call_action;
+HPX_REGISTER_ACTION_DECLARATION(call_action);
+HPX_REGISTER_ACTION(call_action);
+
+typedef A::get_data_action get_data_action;
+HPX_REGISTER_ACTION_DECLARATION(get_data_action);
+HPX_REGISTER_ACTION(get_data_action);
+
+typedef A::checksum_action checksum_action;
+HPX_REGISTER_ACTION_DECLARATION(checksum_action);
+HPX_REGISTER_ACTION(checksum_action);
+
+typedef A::stream_to_action stream_to_action;
+HPX_REGISTER_ACTION_DECLARATION(stream_to_action);
+HPX_REGISTER_ACTION(stream_to_action);
+
+typedef A::check_migration_target_action check_migration_target_action;
+HPX_REGISTER_ACTION_DECLARATION(check_migration_target_action);
+HPX_REGISTER_ACTION(check_migration_target_action);
+
+typedef A::cancel_stream_action cancel_stream_action;
+HPX_REGISTER_ACTION_DECLARATION(cancel_stream_action);
+HPX_REGISTER_ACTION(cancel_stream_action);
+
+struct clientA
+  : hpx::components::client_base<clientA, A>
+{
+    typedef hpx::components::client_base<clientA, A>
+        base_type;
+
+    clientA() {}
+    clientA(hpx::shared_future<hpx::id_type> const& id) : base_type(id) {}
+    clientA(hpx::id_type && id) : base_type(std::move(id)) {}
+
+    hpx::id_type call() const
+    {
+        return call_action()(this->get_id());
+    }
+
+    int get_data() const
+    {
+        return get_data_action()(this->get_id());
+    }
+
+    double checksum() const
+    {
+        return checksum_action()(this->get_id());
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Migrate the object, failing before anything is sent if its payload has
+// been streamed to another locality. Failing while the migrated object is
+// deserialized on the target would surface as an error decoding the parcel.
+clientA migrate_checked(clientA const& to_migrate, hpx::id_type const& target)
+{
+    check_migration_target_action()(to_migrate.get_id(), target);
+    return clientA(hpx::components::migrate<A>(
+        to_migrate.get_id(), target).get());
+}
+
+// Stream the state of the object to the target, then migrate it
+clientA migrate_streaming(clientA const& to_migrate, hpx::id_type const& target,
+    std::size_t chunk_size, std::size_t max_in_flight)
+{
+    std::uint64_t transfer = stream_to_action()(
+        to_migrate.get_id(), target, chunk_size, max_in_flight);
+
+    try {
+        return migrate_checked(to_migrate, target);
+    }
+    catch (...) {
+        // the object stayed where it was, it ships its payload again
+        if (transfer != 0)
+        {
+            cancel_stream_action()(to_migrate.get_id(), transfer);
+            discard_staged_action()(target, transfer);
+        }
+        throw;
+    }
+}
+
+// Peak resident set size of this locality in kB
+long peak_rss()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+HPX_PLAIN_ACTION(peak_rss, peak_rss_action);
+
+///////////////////////////////////////////////////////////////////////////////
+bool test_migrate_large_component(hpx::id_type source, hpx::id_type target,
+    bool streaming)
+{
+    std::size_t const payload_size = std::stoul(hpx::get_config_entry(
+        "mwe.migration.payload_mb", "64")) * 1024 * 1024 / sizeof(double);
+    std::size_t const chunk_size = std::stoul(hpx::get_config_entry(
+        "mwe.migration.chunk_kb", "1024")) * 1024 / sizeof(double);
+    std::size_t const max_in_flight = std::stoul(hpx::get_config_entry(
+        "mwe.migration.max_in_flight", "4"));
+
+    clientA t1 = hpx::new_<clientA>(source, 42, payload_size);
+    HPX_TEST_EQ(t1.call(), source);
+
+    double const expected_checksum = t1.checksum();
+
+    long source_rss = peak_rss_action()(source);
+    long target_rss = peak_rss_action()(target);
+
+    try {
+        hpx::util::high_resolution_timer t;
+
+        clientA t2 = streaming ?
+            migrate_streaming(t1, target, chunk_size, max_in_flight) :
+            migrate_checked(t1, target);
+        HPX_TEST_NEQ(hpx::naming::invalid_id, t2.get_id());
+
+        double elapsed = t.elapsed();
+
+        // the migrated object should have the same id and state as before
+        HPX_TEST_EQ(t1.get_id(), t2.get_id());
+        HPX_TEST_EQ(t2.call(), target);
+        HPX_TEST_EQ(t2.get_data(), 42);
+        HPX_TEST_EQ(t2.checksum(), expected_checksum);
+
+        hpx::cout
+            << "  " << (streaming ? "streaming" : "classic  ") << ": "
+            << elapsed << "s, peak RSS growth source "
+            << peak_rss_action()(source) - source_rss << " kB, target "
+            << peak_rss_action()(target) - target_rss << " kB" << std::endl;
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Streaming with a chunk size or window of zero is rejected
+bool test_invalid_stream_parameters(hpx::id_type source, hpx::id_type target)
+{
+    clientA t1 = hpx::new_<clientA>(source, 42, 1024);
+
+    std::size_t const params[][2] = { { 0, 4 }, { 128, 0 } };
+    for (auto const& p : params)
+    {
+        bool caught_exception = false;
+        try {
+            migrate_streaming(t1, target, p[0], p[1]);
+        }
+        catch (hpx::exception const& e) {
+            caught_exception = e.get_error() == hpx::bad_parameter;
+        }
+        HPX_TEST(caught_exception);
+
+        // the object did not move
+        HPX_TEST_EQ(t1.call(), source);
+    }
+
+    // the object can still be streamed afterwards
+    try {
+        clientA t2 = migrate_streaming(t1, target, 128, 4);
+        HPX_TEST_EQ(t2.call(), target);
+        HPX_TEST_EQ(t2.get_data(), 42);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// An object whose payload has been streamed elsewhere can not be migrated
+// until the stream has been cancelled
+bool test_migrate_streamed_elsewhere(hpx::id_type source, hpx::id_type target)
+{
+    clientA t1 = hpx::new_<clientA>(source, 42, 1024);
+    double const expected_checksum = t1.checksum();
+
+    try {
+        // stage the payload on its own locality, not on the target
+        std::uint64_t transfer =
+            stream_to_action()(t1.get_id(), source, 128, 4);
+        HPX_TEST_NEQ(transfer, std::uint64_t(0));
+
+        bool caught_exception = false;
+        try {
+            migrate_checked(t1, target);
+        }
+        catch (hpx::exception const& e) {
+            caught_exception = e.get_error() == hpx::invalid_status;
+        }
+        HPX_TEST(caught_exception);
+
+        // nothing has been sent, the object did not move
+        HPX_TEST_EQ(t1.call(), source);
+
+        cancel_stream_action()(t1.get_id(), transfer);
+        discard_staged_action()(source, transfer);
+
+        clientA t2 = migrate_checked(t1, target);
+        HPX_TEST_EQ(t2.call(), target);
+        HPX_TEST_EQ(t2.get_data(), 42);
+        HPX_TEST_EQ(t2.checksum(), expected_checksum);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// An object without payload has nothing to stream
+bool test_migrate_empty_component(hpx::id_type source, hpx::id_type target)
+{
+    clientA t1 = hpx::new_<clientA>(source, 42, std::size_t(0));
+
+    try {
+        clientA t2 = migrate_streaming(t1, target, 128, 4);
+        HPX_TEST_EQ(t1.get_id(), t2.get_id());
+        HPX_TEST_EQ(t2.call(), target);
+        HPX_TEST_EQ(t2.get_data(), 42);
+        HPX_TEST_EQ(t2.checksum(), 0.0);
+    }
+    catch (hpx::exception const& e) {
+        hpx::cout << hpx::get_error_what(e) << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main()
+{
+    std::string const mode =
+        hpx::get_config_entry("mwe.migration.mode", "both");
+    bool const stream = mode == "stream" || mode == "both";
+    bool const classic = mode == "classic" || mode == "both";
+
+    std::vector<hpx::id_type> localities = hpx::find_remote_localities();
+    if (localities.empty())
+    {
+        hpx::cout << "streaming migration needs at least two localities"
+            << std::endl;
+    }
+
+    for (hpx::id_type const& id : localities)
+    {
+        hpx::cout << "test_migrate_large_component: ->" << id << std::endl;
+        if (stream)
+            HPX_TEST(test_migrate_large_component(hpx::find_here(), id, true));
+        if (classic)
+            HPX_TEST(test_migrate_large_component(hpx::find_here(), id, false));
+
+        hpx::cout << "test_invalid_stream_parameters: ->" << id << std::endl;
+        HPX_TEST(test_invalid_stream_parameters(hpx::find_here(), id));
+
+        hpx::cout << "test_migrate_empty_component: ->" << id << std::endl;
+        HPX_TEST(test_migrate_empty_component(hpx::find_here(), id));
+
+        hpx::cout << "test_migrate_streamed_elsewhere: ->" << id << std::endl;
+        HPX_TEST(test_migrate_streamed_elsewhere(hpx::find_here(), id));
+    }
+
+    return hpx::util::report_errors();
+}